@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <align_detect.h>
+
+void align_init(align_window_t *align, const align_config_t *cfg){
+	align->cfg = cfg;
+	align_reset(align);
+}
+
+void align_reset(align_window_t *align){
+	align->n = align->head = 0;
+	align->outside = false;
+}
+
+/* align_add(detector, error)
+ * A single error out of the threshold is kept, as a wrong detection the decision can leave out.
+ * Two in a row mean the robot is still turning: the samples before describe another heading
+ * and the window starts over.
+ */
+void align_add(align_window_t *align, int16_t error){
+
+	bool outside = abs(error) >= align->cfg->threshold;
+
+	if(outside && align->outside)
+		align->n = align->head = 0;
+	align->outside = outside;
+	align->error[align->head] = error;
+	align->head = (align->head + 1) % align->cfg->window;
+	if(align->n < align->cfg->window)
+		align->n++;
+}
+
+/* align_converged(detector)
+ * Mean and variance of the errors in the window. Above min_samples, the sample furthest
+ * from the mean is left out so an isolated outlier doesn't block the alignment.
+ * Aligned when the mean, plus its uncertainty, is within the threshold.
+ */
+bool align_converged(const align_window_t *align){
+
+	const align_config_t *cfg = align->cfg;
+	float mean = 0, var = 0;
+	uint8_t i = 0, n = align->n, outlier = ALIGN_WINDOW_MAX;
+
+	if(align->n < cfg->min_samples || align->n < 2)
+		return false;
+
+	for(i = 0; i < align->n; i++)
+		mean += align->error[i];
+	mean /= align->n;
+
+	if(align->n > cfg->min_samples && align->n > 2)
+	{
+		for(i = 0; i < align->n; i++)
+			if(outlier == ALIGN_WINDOW_MAX || fabsf(align->error[i] - mean) > fabsf(align->error[outlier] - mean))
+				outlier = i;
+		mean = (mean*align->n - align->error[outlier])/(align->n - 1);
+		n--;
+	}
+
+	for(i = 0; i < align->n; i++)
+		if(i != outlier)
+			var += (align->error[i] - mean)*(align->error[i] - mean);
+	var /= (n - 1);
+
+	return fabsf(mean) + cfg->confidence*sqrtf(var/n) <= cfg->threshold;
+}
@@ -0,0 +1,28 @@
+#ifndef ALIGN_DETECT_H
+#define ALIGN_DETECT_H
+
+#define ALIGN_WINDOW_MAX		16 //samples a detector can keep
+
+//Parameters of an alignment detector, meant to be declared const so they are fixed at compile time
+typedef struct {
+	uint8_t window;			//last samples kept, at most ALIGN_WINDOW_MAX
+	uint8_t min_samples;	//no decision with fewer samples
+	float threshold;		//the mean error must be within it
+	float confidence;		//standard errors of the mean that must fit in the threshold too
+} align_config_t;
+
+typedef struct {
+	const align_config_t *cfg;
+	int16_t error[ALIGN_WINDOW_MAX];	//ring buffer of the last errors
+	uint8_t n;
+	uint8_t head;
+	bool outside;						//last error out of the threshold
+} align_window_t;
+
+void align_init(align_window_t *align, const align_config_t *cfg);
+void align_reset(align_window_t *align);
+void align_add(align_window_t *align, int16_t error);
+//true when the mean error, plus its uncertainty, is within the threshold
+bool align_converged(const align_window_t *align);
+
+#endif /* ALIGN_DETECT_H */
@@ -8,11 +8,11 @@
 #include <audio/microphone.h>
 
 #include <main.h>
-#include <motors.h>
+#include <motor_arbiter.h>
 #include <audio_processing.h>
 
 #define SPEED_WAIT_COMMAND	400
-#define SPEED_MV_COMMAND		700
+#define SPEED_MV_COMMAND		700 //the obstacle avoidance slows it down near walls and obstacles
 #define MIN_VALUE_THRESHOLD	17500
 
 //Y=aX+b with a = 0.064015827312713 and b = 0.01881259825829
@@ -79,14 +79,12 @@ void sound_remote(float* data)
 		{
 			//move forward when there's a continuous pitch at given freq
 			if(max_norm_index >=  FRQ_FORWARD_MIN && max_norm_index <= FRQ_FORWARD_MAX){
-				left_motor_set_speed(SPEED_MV_COMMAND);
-				right_motor_set_speed(SPEED_MV_COMMAND);
+				motor_request(MOTOR_REMOTE, SPEED_MV_COMMAND, SPEED_MV_COMMAND);
 				shouldTurn=false;
 			}
 			//Start to search for ball if freq is matching
 			else if(max_norm_index >= FRQ_SEARCH_MIN && max_norm_index <= FRQ_SEARCH_MAX){
-				left_motor_set_speed(0);
-				right_motor_set_speed(0);
+				motor_request(MOTOR_REMOTE, 0, 0);
 				switchState(true);
 				shouldTurn=false;
 			}
@@ -95,8 +93,7 @@ void sound_remote(float* data)
 		}
 		//turn around while waiting for command
 		if(shouldTurn){
-			left_motor_set_speed(-SPEED_WAIT_COMMAND);
-			right_motor_set_speed(SPEED_WAIT_COMMAND);
+			motor_request(MOTOR_REMOTE, -SPEED_WAIT_COMMAND, SPEED_WAIT_COMMAND);
 		}
 	}
 	prev_freq = max_norm_index;
@@ -1,36 +1,73 @@
 #include "ch.h"
 #include "hal.h"
+#include <math.h>
 
 #include <main.h>
 #include <eputt_regulator.h>
 #include <motors.h>
 #include <process_image.h>
-#include <sensors/VL53L0X/VL53L0X.h>
+#include <pid.h>
+#include <align_detect.h>
+#include <regulator_tuning.h>
+#include <motion_profile.h>
+#include <motor_arbiter.h>
+#include <ir_proximity.h>
+#include <odometry.h>
+#include <tof.h>
+#include <chprintf.h>
 
 //Temporal paremeters during research
 #define TIME_BALL_NF_MS		700 //Maxmimum allowed time [ms] of ball out of sight
 #define TIME_FORCETURN_MS	100 //Force turn for given [ms] if dubious reads are obtained
 #define MAX_TIME_FINDBALL_MS	6000 //time [ms] to settle and find ball
-//Temporal parameters during charging
-#define MAX_TIME_OFS_MS 		1000 //900 before, to change if wanted
-#define TIMEOUT_SHOOT_MS		100
-#define MAX_TIME_SHOOT_MS	(1000+MAX_TIME_OFS_MS) //means max shot dist is just above 20mm
-
-//Regulator parameters
-#define KP					0.5f
-#define KI 					0.15f
-#define KI_PRIOR				0.93f
-#define MAX_SUM_ERROR 		(MOTOR_SPEED_LIMIT/(5*KI))
-#define GOAL_DISTANCE 		(IMAGE_BUFFER_SIZE/2)
-#define MEAS_POTENTIAL		20
+//Failsafe of the charge, which is otherwise followed in distance
+#define CHARGE_TIMEOUT_MS	5000
+#define MS_PER_S				1000
 
-//Precision of alignment
-#define ROTATION_THRESHOLD	10	//pxl, cannot align perfectly anyway
-#define ALIGNED_CNT			12
+//Regulator parameters, the tunable ones are in regulator_tuning.h
+#define GOAL_DISTANCE 		(IMAGE_BUFFER_SIZE/2)
+//Fresh frames without the ball before turning, about the 200ms of the former 20 polls of 10ms
+#ifndef MEAS_POTENTIAL
+#define MEAS_POTENTIAL		3 //frames
+#endif
+#if ALIGN_WINDOW > ALIGN_WINDOW_MAX
+#error "ALIGN_WINDOW is larger than the detector"
+#endif
+
+//Trace of the regulator sent on the bluetooth serial (SD3) at each new frame, used to fit
+//the plant and tune the parameters offline. One CSV line per frame:
+//time [ms], state, ball seen, ball position, left speed, right speed, left steps, right steps
+#ifndef REGULATOR_TRACE
+#define REGULATOR_TRACE		0
+#endif
+#define TRACE_BAUDRATE		115200
+#if REGULATOR_TRACE
+#define REGULATOR_STACK		1024 //chprintf needs room
+#else
+#define REGULATOR_STACK		512
+#endif
+
+//Events waking the regulator
+#define EVT_FRAME			EVENT_MASK(0)
+#define EVT_STATE			EVENT_MASK(1)
+#define EVT_TOF				EVENT_MASK(2)
+//1: wakes every TIME_MS_PIDREG whatever the sensors, as before the events, to compare them
+#ifndef REGULATOR_POLL
+#define REGULATOR_POLL		0
+#endif
+#if REGULATOR_POLL
+#define WAKE_EVENTS			0
+#define SAFETY_TICK_MS		TIME_MS_PIDREG
+#else
+#define WAKE_EVENTS			ALL_EVENTS
+#define SAFETY_TICK_MS		50 //timeouts are still checked without any event
+#endif
+#define STATS_WINDOW_MS		1000
 
 //Speeds
 #define MANUAL_TURN_SPEED	(MOTOR_SPEED_LIMIT/2)
 #define CHARGE_SPEED 		(MOTOR_SPEED_LIMIT-100)
+#define APPROACH_SPEED		(2*MOTOR_SPEED_LIMIT/3)
 
 //Distance parameters for charge mode
 #define COLOR_CORRECTION_MM	60 //empirical value, TO CHANGE IF BALL COLOR IS CHANGED
@@ -40,74 +77,267 @@
 #define MAX_DIST_OFS_MM		60 //If the E-Putt is closer than that, the ball becomes out of sight
 #define MIN_DIST_MM			(CORRECTION_FACTOR*BALL_RADIUS_MM+THRESHOLD_MM)
 #define DIST_DETECT_MM		(MAX_DIST_OFS_MM+BALL_RADIUS_MM+COLOR_CORRECTION_MM+THRESHOLD_MM)
+#define CONTACT_DIST_MM		(CORRECTION_FACTOR*BALL_RADIUS_MM) //TOF read when touching the ball
+#define FOLLOW_THROUGH_MM	25 //pushed after the contact to give inertia to the ball, braking included
+#define MAX_APPROACH_MM		450 //further than the camera can see the ball: removed or missed
+#define MAX_BLIND_MM			40 //travel allowed without a TOF read before the contact
+
+//Aiming on the goal marker before charging
+#define AIM_THRESHOLD_PXL	20 //goal and ball are considered aligned under this offset
+#define AIM_MAX_REPOSITION	3 //arc repositions allowed before charging anyway
+#define AIM_GAIN				1.5f //the goal is further than the ball, orbit more than the seen offset
+#define AIM_MAX_ANGLE		0.8f //[rad]
+#define AIM_SPEED			(MOTOR_SPEED_LIMIT/3)
+#define QUARTER_TURN_STEPS	MM_TO_STEPS(M_PI*WHEEL_DISTANCE_MM/4)
+
+//Approach: drives toward the ball while correcting the bearing, then hands off to the charge
+//Closer than the hand-off, charging at once is faster: the charge is quicker than the approach,
+//and a pursuit started off the bearing arrives off the goal line and needs an orbit.
+#ifndef APPROACH_STOP_MM
+#define APPROACH_STOP_MM		250 //camera estimate, inside the range of the charge
+#endif
+#ifndef APPROACH_MAX_BEARING
+#define APPROACH_MAX_BEARING	0.2f //[rad] no advance above this bearing, only rotation
+#endif
+//1: aligns on the spot and charges from there, as before the approach, to compare them
+#ifndef ALIGN_THEN_CHARGE
+#define ALIGN_THEN_CHARGE	0
+#endif
+
+//Search when the ball is lost: toward its last bearing first, then widening sweeps
+#ifndef SEARCH_FIRST_MARGIN
+#define SEARCH_FIRST_MARGIN	0.5f //[rad] turned past the expected bearing before sweeping back
+#endif
+#define SEARCH_SWEEP_GROWTH	2.0f //each sweep is this much wider than the previous one
+//1: spins clockwise whatever the last bearing, as before the sweeps, to compare them
+#ifndef SEARCH_SPIN
+#define SEARCH_SPIN			0
+#endif
+
+//Phases of the arc reposition around the ball
+enum aimPhase{AIM_IDLE = 0, AIM_TURN_OUT, AIM_ARC, AIM_TURN_BACK};
+
+//Bearing controller: rotation speed from the ball offset in the image
+static const pid_config_t bearing_pid_cfg = {
+	.kp = KP,
+	.ki = KI,
+	.kd = KD,
+	.leak = KI_PRIOR, //the system forgets with time, recommended with discrete PI regs.
+	.int_max = MAX_SUM_ERROR,
+	.deadband = ROTATION_THRESHOLD, //cannot align perfectly anyway
+	.out_max = MOTOR_SPEED_LIMIT,
+	.slew_max = 0,
+};
+static pid_ctrl_t bearing_pid = {.cfg = &bearing_pid_cfg};
+
+static enum aimPhase aim_phase = AIM_IDLE;
+//goal marker from the ball in the image, last seen: close to the ball, the ball hides it
+static int16_t goal_offset = 0;
+static bool goal_known = false;
+static int8_t aim_side = 0; //1: orbit to the left of the ball, -1: to the right
+static int32_t aim_arc_steps = 0, left_start = 0, right_start = 0;
+static uint16_t aim_radius = 0;
+
+//Alignment on the ball from the last bearing errors [pxl]
+static const align_config_t align_cfg = {
+	.window = ALIGN_WINDOW,
+	.min_samples = ALIGN_MIN_SAMPLES,
+	.threshold = ROTATION_THRESHOLD,
+	.confidence = ALIGN_CONFIDENCE,
+};
+static align_window_t bearing_align = {.cfg = &align_cfg};
+
+//where the ball was last seen, in the odometry frame
+static float ball_heading = 0;
+static bool ball_heading_known = false;
+static int8_t ball_side = 0; //side of the image the ball was last seen on, 1: left
+static bool searching = false;
+
+static regulator_stats_t regulator_stats = {0};
+static charge_stats_t charge_stats = {0};
+
+static void aim_next_phase(enum aimPhase phase){
+	aim_phase = phase;
+	left_start = left_motor_get_pos();
+	right_start = right_motor_get_pos();
+}
 
-// needs to be global to file as it is reset if certain conditions are met
-static int16_t sum_error = 0; //integral error
-
-/* pi_regulator(System output, desired System output)
- * Simple implementation of a discrete PI regulator, (de)activated by the main regulator.
+/* aim_start(ball position, goal position, ball distance)
+ * Plans an orbit around the ball that brings the robot on the goal-ball line.
+ * The goal distance is unknown, so the orbit angle is the seen angle times AIM_GAIN
+ * and the remaining offset is corrected by the next repositions.
  */
-int16_t pi_regulator(uint16_t distance, uint16_t goal){
+static void aim_start(uint16_t ball, uint16_t goal, uint16_t dist){
 
-	int16_t error = 0;
-	int16_t speed = 0;
+	float angle = AIM_GAIN*((int16_t)goal - (int16_t)ball)/FOCAL_PXL;
 
-	error = distance - goal;
+	if(angle > AIM_MAX_ANGLE)
+		angle = AIM_MAX_ANGLE;
+	else if(angle < -AIM_MAX_ANGLE)
+		angle = -AIM_MAX_ANGLE;
 
-	//disables the PI regulator if the error is to small
-	if(abs(error) < ROTATION_THRESHOLD){
-		return 0;
+	//goal on the right of the ball: the robot has to go on the left of the ball
+	aim_side = (angle > 0) ? 1 : -1;
+	aim_radius = (dist > WHEEL_DISTANCE_MM) ? dist : WHEEL_DISTANCE_MM;
+	aim_arc_steps = MM_TO_STEPS(fabsf(angle)*aim_radius);
+	aim_next_phase(AIM_TURN_OUT);
+}
+
+/* aim_reposition()
+ * Quarter turn away from the ball, arc of aim_radius centered on the ball, quarter turn back.
+ * Returns true as long as the maneuver is running.
+ */
+static bool aim_reposition(void){
+
+	int32_t travelled = (abs(left_motor_get_pos() - left_start) + abs(right_motor_get_pos() - right_start))/2;
+	int16_t inner = AIM_SPEED*(aim_radius - WHEEL_DISTANCE_MM/2)/aim_radius;
+	int16_t outer = AIM_SPEED*(aim_radius + WHEEL_DISTANCE_MM/2)/aim_radius;
+
+	switch(aim_phase)
+	{
+		case AIM_TURN_OUT:
+			if(travelled >= QUARTER_TURN_STEPS)
+				aim_next_phase(AIM_ARC);
+			motor_request(MOTOR_REGULATOR, -aim_side*AIM_SPEED, aim_side*AIM_SPEED);
+			break;
+		case AIM_ARC: //the ball is on the inner side of the arc
+			if(travelled >= aim_arc_steps)
+				aim_next_phase(AIM_TURN_BACK);
+			motor_request(MOTOR_REGULATOR, aim_side > 0 ? outer : inner, aim_side > 0 ? inner : outer);
+			break;
+		case AIM_TURN_BACK:
+			if(travelled >= QUARTER_TURN_STEPS)
+			{
+				aim_phase = AIM_IDLE;
+				motor_request(MOTOR_REGULATOR, 0, 0);
+				return false;
+			}
+			motor_request(MOTOR_REGULATOR, aim_side*AIM_SPEED, -aim_side*AIM_SPEED);
+			break;
+		default:
+			return false;
 	}
+	return true;
+}
+
+static void search_memorize(void){
+	//a ball on the right of the image is at a lower heading (counterclockwise positive)
+	ball_heading = odometry_get_heading() - ((int16_t)getBallPos() - GOAL_DISTANCE)/(float)FOCAL_PXL;
+	ball_heading_known = true;
+	ball_side = getBallPos() < GOAL_DISTANCE ? 1 : -1;
+	searching = false;
+}
+
+/* search_turn_speed()
+ * Rotation speed while the ball is lost. The robot turns toward the side of the image where
+ * the ball was last seen, past its heading by SEARCH_FIRST_MARGIN, then sweeps back and forth
+ * around it, wider each time, until the sweeps cover a full turn and it just keeps spinning.
+ * The side rather than the heading gives the way: the robot may already have turned past the
+ * heading after a ball leaving the image.
+ * Without any heading to sweep around, the robot spins.
+ * Positive speeds turn right (clockwise), as for the PI regulator.
+ */
+static int16_t search_turn_speed(void){
+
+	static float sweep_amp = 0;
+	static int8_t sweep_dir = 0; //1: counterclockwise
 
-	//We multiply the previous accumulated error with a constant < 1. System forgets with time
-	//It's a recommended thing to do with discrete PI regs.
-	sum_error = sum_error*KI_PRIOR + error;
+	float heading = odometry_get_heading();
 
-	//Anti-Reset-Windup
-	if(sum_error > MAX_SUM_ERROR){
-		sum_error = MAX_SUM_ERROR;
-	}else if(sum_error < -MAX_SUM_ERROR){
-		sum_error = -MAX_SUM_ERROR;
+	if(SEARCH_SPIN || !ball_heading_known)
+		return MANUAL_TURN_SPEED;
+	if(!searching)
+	{
+		searching = true;
+		sweep_dir = ball_side;
+		sweep_amp = SEARCH_FIRST_MARGIN;
 	}
 
-	speed = KP * error + KI * sum_error;
-    return speed;
+	if(sweep_amp < M_PI && sweep_dir*(heading - ball_heading) >= sweep_amp)
+	{
+		sweep_dir = -sweep_dir;
+		sweep_amp *= SEARCH_SWEEP_GROWTH;
+	}
+	return -sweep_dir*MANUAL_TURN_SPEED;
+}
+
+/* approach_speed(bearing, ball distance)
+ * Forward speed toward the ball, slowed down as the bearing grows so the robot turns
+ * on the spot when it is far off, and zero once close enough to hand off to the charge.
+ */
+static int16_t approach_speed(float bearing, uint16_t dist){
+
+	if(ALIGN_THEN_CHARGE || dist <= APPROACH_STOP_MM || fabsf(bearing) >= APPROACH_MAX_BEARING)
+		return 0;
+	return APPROACH_SPEED*(1 - fabsf(bearing)/APPROACH_MAX_BEARING);
+}
+
+/* approach_rotation(forward speed, bearing, ball distance)
+ * Pure pursuit on the ball: differential speed that puts the robot on the circle
+ * through the ball, tangent to its heading. Used as feedforward of the bearing PID.
+ */
+static float approach_rotation(int16_t forward, float bearing, uint16_t dist){
+
+	if(forward == 0 || dist == 0)
+		return 0;
+	return forward*WHEEL_DISTANCE_MM*sinf(bearing)/dist;
 }
 
 /*THREAD: Regulator*/
-static THD_WORKING_AREA(waRegulator, 256);
+static THD_WORKING_AREA(waRegulator, REGULATOR_STACK);
 static THD_FUNCTION(Regulator, arg){
 
     chRegSetThreadName(__FUNCTION__);
     (void)arg;
 
-    systime_t time;
+    systime_t time_window = chVTGetSystemTime();
     enum eputtState curr_state;
+    eventmask_t events;
+    event_listener_t frame_listener, state_listener, tof_listener;
+    uint16_t wakeups = 0;
+    bool tick = false;
+
+    chEvtRegisterMask(getFrameEvent(), &frame_listener, EVT_FRAME);
+    chEvtRegisterMask(getStateEvent(), &state_listener, EVT_STATE);
+    chEvtRegisterMask(tof_get_event(), &tof_listener, EVT_TOF);
     
     while(1)
     {
-		time = chVTGetSystemTime();
+		//wakes up on a new frame, a new TOF sample, a state change or the periodic tick
+		events = chEvtWaitAnyTimeout(WAKE_EVENTS, MS2ST(SAFETY_TICK_MS));
+
 		curr_state = getState();
+		tick = (events == 0);
+		wakeups++;
 
         if(curr_state == SEARCH_BALL || curr_state == BALL_LOCKED || curr_state == CHARGE_BALL)
         {
         		if(curr_state != CHARGE_BALL)
         			regulator_position(false);
-        		if(curr_state != SEARCH_BALL)
+        		if(curr_state != SEARCH_BALL && (tick || (events & (EVT_TOF | EVT_STATE))))
         			distance_stop(false);
         }
         else
         {
         		regulator_position(true);
         		distance_stop(true);
+        		motor_release(MOTOR_REGULATOR);
+        		motor_release(MOTOR_CHARGE);
         }
-		chThdSleepUntilWindowed(time, time + MS2ST(TIME_MS_PIDREG));
+
+		if(chVTGetSystemTime() - time_window >= MS2ST(STATS_WINDOW_MS))
+		{
+			regulator_stats.wakeups = wakeups;
+			wakeups = 0;
+			time_window = chVTGetSystemTime();
+		}
     }
 }
 
 /*
 * This is the main regulator. It behaves differently depending if the ball is in sight or not.
 * BALL IN SIGHT: lets PI regulator calculate rotation speed
+* 		and drives toward the ball until APPROACH_STOP_MM, the charge starts from there once aligned
 * BALL OUT OF SIGHT:
 * 		A) if the ball recently been out of sight been out of sight is small, still let PI controller
 * 			maybe it will find it again in the meantime (this allow false read from camera)
@@ -119,18 +349,49 @@ void regulator_position(bool reset){
 
     static systime_t time_nf, time_falsefound, time_max_exec = 0;
 
-    static int16_t speed = 0;
+    static int16_t speed = 0, approach = 0;
     static uint16_t speed_offset = 0;
-    static uint8_t aligned_cnt = 0, measure_potential = 0;
+    static uint8_t measure_potential = 0, aim_cnt = 0;
     static bool ball_nf = false, manual_turn = false, forceturn = false;
+    static uint32_t last_frame = 0;
+
+    bool fresh = false, aligned = false;
+    float bearing = 0;
 
 	if (reset)
 	{
 		time_max_exec = chVTGetSystemTime();
-		speed = sum_error = 0;
+		speed = approach = 0;
+		pid_reset(&bearing_pid);
 		speed_offset = 0;
-		aligned_cnt = 0;
+		aim_cnt = 0;
+		goal_known = false;
+		align_reset(&bearing_align);
+		aim_phase = AIM_IDLE;
+		searching = false;
+		//the last bearing is kept for the automatic retries, not once the operator drives
+		if(getState() == MANUAL_MOVE || getState() == STARTUP)
+			ball_heading_known = false;
 		ball_nf = manual_turn = forceturn = false;
+		last_frame = getFrameSeq();
+		return;
+	}
+
+	//the camera results are only used once, ticks without a new frame only check the timeouts
+	fresh = (getFrameSeq() != last_frame);
+	last_frame = getFrameSeq();
+
+	//the robot is moving around the ball to face the goal, the camera can't be trusted
+	if(aim_phase != AIM_IDLE)
+	{
+		if(!aim_reposition())
+		{
+			//facing the ball again, the alignment starts over
+			time_max_exec = chVTGetSystemTime();
+			speed = approach = 0;
+			pid_reset(&bearing_pid);
+			align_reset(&bearing_align);
+		}
 		return;
 	}
 
@@ -148,7 +409,7 @@ void regulator_position(bool reset){
 	//if it has been missing for too long (either unseen or dubious read), go manual turn.
 	else if (ball_nf && getState() == SEARCH_BALL)
 	{
-		if(measure_potential > 0)
+		if(measure_potential > 0 && fresh)
 		{
 			--measure_potential;
 			if(measure_potential==0)
@@ -164,25 +425,62 @@ void regulator_position(bool reset){
 			forceturn = false;
 	}
 
-	if (!manual_turn)
-		speed = pi_regulator(getBallPos(), (IMAGE_BUFFER_SIZE/2));
-	else if (getState() == SEARCH_BALL)
-		speed = MANUAL_TURN_SPEED;
+	if (!manual_turn && fresh)
+	{
+		bearing = ((int16_t)getBallPos() - GOAL_DISTANCE)/(float)FOCAL_PXL;
+		speed = pid_update(&bearing_pid, getBallPos() - GOAL_DISTANCE,
+							approach_rotation(approach, bearing, getBallDistMm()));
+
+		//advance while turning, the search timeout only applies while no progress is made
+		if(getState() == SEARCH_BALL && ballSeenLast() && speed_offset == 0)
+			approach = approach_speed(bearing, getBallDistMm());
+		else
+			approach = 0;
+		if(approach)
+			time_max_exec = chVTGetSystemTime();
+	}
+	else if (manual_turn && getState() == SEARCH_BALL)
+	{
+		speed = search_turn_speed();
+		approach = 0;
+	}
+
+	if(fresh && ballSeenLast())
+		search_memorize();
 
-	//if the ball is nearly in front of the camera, don't rotate and validate
-	if(abs(speed) <= ROTATION_THRESHOLD && speed_offset == 0 && ballSeenLast())
-		aligned_cnt++;
-	else if (speed_offset == 0)
-		aligned_cnt = 0;
+	//each new read of the ball feeds the alignment, a frame without it is just skipped
+	if(manual_turn)
+		align_reset(&bearing_align);
+	else if(fresh && ballSeenLast() && speed_offset == 0)
+		align_add(&bearing_align, getBallPos() - GOAL_DISTANCE);
+	aligned = align_converged(&bearing_align);
 
-	//if we're aligned on multiple read, it's time to charge
-	if(aligned_cnt > ALIGNED_CNT && speed_offset==0)
+	if(fresh && ballSeenLast() && goalSeen() && getState() == SEARCH_BALL)
+	{
+		goal_offset = getGoalPos() - getBallPos();
+		goal_known = true;
+	}
+
+	//aligned on the ball but not on the goal marker: orbit around the ball first
+	if(aligned && speed_offset == 0 && approach == 0 && getState() == SEARCH_BALL && goal_known
+		&& abs(goal_offset) > AIM_THRESHOLD_PXL && aim_cnt < AIM_MAX_REPOSITION)
+	{
+		aim_cnt++;
+		aim_start(getBallPos(), getBallPos() + goal_offset, getBallDistMm());
+		goal_known = false;
+		align_reset(&bearing_align);
+		motor_request(MOTOR_REGULATOR, 0, 0);
+		return;
+	}
+	//if we're aligned on multiple read and close enough, it's time to charge
+	else if(aligned && speed_offset==0 && approach == 0)
 	{
 		if(getState() == SEARCH_BALL)
 			switchState(true);
 		speed_offset = CHARGE_SPEED;
-		aligned_cnt = 0;
-		sum_error=0;
+		motion_soft_charge();
+		align_reset(&bearing_align);
+		pid_reset(&bearing_pid);
 	}
 	//ball has gotten out of sight (ie: too near or removed by a mean user), just charge straight
 	else if (getState() == BALL_LOCKED && !ballSeenLast())
@@ -194,88 +492,157 @@ void regulator_position(bool reset){
 
 	if(getState() == SEARCH_BALL && (chVTGetSystemTime() - time_max_exec > MS2ST(MAX_TIME_FINDBALL_MS)))
 	{
-		speed = 0;
+		speed = approach = 0;
 		switchState(false);
 	}
 
 	if (getState() == CHARGE_BALL)
 		speed = 0;
 
-	right_motor_set_speed(speed_offset-speed);
-	left_motor_set_speed(speed+speed_offset);
+	//the command from a new frame is timed from the end of the frame to the wheels
+	if(fresh && !manual_turn)
+		motor_request_from(MOTOR_REGULATOR, approach+speed+speed_offset, approach+speed_offset-speed, getFrameTime());
+	else
+		motor_request(MOTOR_REGULATOR, approach+speed+speed_offset, approach+speed_offset-speed);
+
+#if REGULATOR_TRACE
+	if(fresh)
+		chprintf((BaseSequentialStream *)&SD3, "%u,%u,%u,%u,%d,%d,%d,%d\r\n",
+				ST2MS(chVTGetSystemTime()), getState(), ballSeenLast(), getBallPos(),
+				approach+speed+speed_offset, approach+speed_offset-speed, left_motor_get_pos(), right_motor_get_pos());
+#endif
 }
 
 /*
 * This handles the charging when the ball is: in sight and out of sight.
-* Try to see if there's an object nearby with Time of Flight sensor.
-* 	A) First distance calculated should be a distance when the ball becomes out of sight to the camera
-* 			switch to charge and assume successful shot incoming.
-* 	B) if the ball has been gone for too long, switch to constant speed turn in hope to find it again
+* The charge is followed in travelled millimeters from the motor steps, not in time,
+* so it doesn't depend on the speed or the battery level.
+* 	A) A Time of Flight read in range switches to charge. Each new read predicts where the contact
+* 		will happen. The closing speed between two reads gives when, only kept as a diagnostic.
+* 	B) Once the contact point is passed, the braking from the current speed is started so that
+* 		it ends FOLLOW_THROUGH_MM after it, and the shot is successful.
+* 		If the IR sensors see the ball touch and leave before, the shot ends right away.
+* 	C) It fails if the ball is never read, or if it vanishes from the TOF before the contact.
+* The charge command is requested again on every call, a request not refreshed expires.
 */
 void distance_stop(bool reset){
 
-    static systime_t time_start_shoot = 0, timer_stop = 0, time_shootdelay = 0;
+    static systime_t time_start = 0, time_sample = 0;
+    static int32_t start_left = 0, start_right = 0;
+    static int16_t travel_sample = 0, travel_contact = 0;
+    static uint32_t prev_seq = 0;
+    static uint16_t prev_dist = 0;
     static bool isCharging = false;
-    static bool isOutOfSight = false;
-    static bool isShooting = false;
+    static bool ballDetected = false;
+    static bool chargeActive = false;
+    static int16_t charge_speed = 0;
 
-    uint16_t dist = 0;
+    tof_sample_t sample;
+    int16_t travelled = 0;
 
 	if (reset)
 	{
-		time_start_shoot = timer_stop = time_shootdelay = 0;
-		isShooting = isCharging = isOutOfSight = false;
+		travel_sample = travel_contact = 0;
+		prev_dist = 0;
+		isCharging = ballDetected = chargeActive = false;
 		return;
 	}
 
 	if(!isCharging)
 	{
 		isCharging=true;
-		time_start_shoot = chVTGetSystemTime();
+		time_start = chVTGetSystemTime();
+		start_left = left_motor_get_pos();
+		start_right = right_motor_get_pos();
 	}
 
-	dist = VL53L0X_get_dist_mm();
+	//the regulator doesn't drive during the charge, even without a TOF read in range
+	if(getState() == CHARGE_BALL && !chargeActive)
+	{
+		chargeActive = true;
+		charge_speed = CHARGE_SPEED;
+	}
 
-	if (dist > 0 && dist < DIST_DETECT_MM)
+	travelled = STEPS_TO_MM(((left_motor_get_pos() - start_left) + (right_motor_get_pos() - start_right))/2);
+	charge_stats.travelled_mm = travelled;
+	sample = tof_get_sample();
+
+	if (sample.valid && sample.dist_mm < DIST_DETECT_MM)
 	{
 		if(getState() == BALL_LOCKED)
 			switchState(true); //failsafe, should not happen before the one in controller
-		timer_stop = chVTGetSystemTime();
-		isOutOfSight = true;
-		right_motor_set_speed(CHARGE_SPEED);
-		left_motor_set_speed(CHARGE_SPEED);
+		if(!chargeActive)
+		{
+			chargeActive = true;
+			charge_speed = CHARGE_SPEED;
+		}
 
+		//each sample is only used once. Past the contact, the TOF reads the ball being pushed:
+		//the contact point is kept, or it would move ahead with the robot
+		if(sample.seq != prev_seq && !(ballDetected && travelled >= travel_contact))
+		{
+			if(ballDetected && prev_dist > sample.dist_mm && sample.time != time_sample)
+			{
+				charge_stats.closing_speed = ((prev_dist - sample.dist_mm)*MS_PER_S)/ST2MS(sample.time - time_sample);
+				if(charge_stats.closing_speed)
+					charge_stats.contact_time_ms = ((sample.dist_mm > CONTACT_DIST_MM ? sample.dist_mm - CONTACT_DIST_MM : 0)
+													*MS_PER_S)/charge_stats.closing_speed;
+			}
+			time_sample = sample.time;
+			prev_dist = sample.dist_mm;
+			travel_sample = travelled;
+			travel_contact = travelled + (sample.dist_mm > CONTACT_DIST_MM ? sample.dist_mm - CONTACT_DIST_MM : 0);
+			charge_stats.contact_travel_mm = travel_contact;
+			ballDetected = true;
+		}
 	}
+	prev_seq = sample.seq;
 
-	//If we're guaranteed to hit the ball, extend slightly the shoot time to give more inertia
-	if(dist > 0 && dist < MIN_DIST_MM && !isShooting)
+	//the IR sensors saw the ball being hit and leaving: the shot is done
+	if(ir_ball_released())
 	{
-		time_shootdelay = chVTGetSystemTime();
-		isShooting = true;
+		if(getState() == CHARGE_BALL)
+			switchState(true);
+		charge_speed = 0;
 	}
-	else if(isShooting && (chVTGetSystemTime() - time_shootdelay > MS2ST(TIMEOUT_SHOOT_MS)))
+	//past the contact point, stop so that the braking ends the follow-through
+	else if(ballDetected && travelled >= travel_contact
+			&& travelled + motion_braking_mm(motion_get_speed()) >= travel_contact + FOLLOW_THROUGH_MM)
 	{
 		if(getState() == CHARGE_BALL)
 			switchState(true);
-		right_motor_set_speed(0);
-		left_motor_set_speed(0);
+		charge_speed = 0;
 	}
-
-	/*If ball has been sighted by TOF but either these happen:
-     *  -time to hit the ball has expired
-	 *	-elapsed time between high and low distance read is not respected (=>ball has vanished)
-	 *	-total time allowed to shoot has expired (ball is way too far or the ball was removed)
+	/*Fails if either these happen:
+	 *	-the ball has never been read and the max distance is travelled (ball too far or removed)
+	 *	-the ball is not read anymore long before the predicted contact and isn't touching (=>ball has vanished)
+	 *	-the charge takes way too long, failsafe
 	 */
-	if((isShooting && (chVTGetSystemTime() - time_start_shoot > MS2ST(MAX_TIME_SHOOT_MS+time_shootdelay) ||
-		(/*isOutOfSight &&*/ (chVTGetSystemTime() - timer_stop > MS2ST(MAX_TIME_OFS_MS+time_shootdelay))))) ||
-		(chVTGetSystemTime() - time_start_shoot > MS2ST(MAX_TIME_SHOOT_MS+MAX_TIME_OFS_MS+time_shootdelay)))
+	else if((!ballDetected && travelled > MAX_APPROACH_MM) ||
+		(ballDetected && !ir_ball_contact() && travelled - travel_sample > MAX_BLIND_MM) ||
+		(chVTGetSystemTime() - time_start > MS2ST(CHARGE_TIMEOUT_MS)))
 	{
 		switchState(false);
-		right_motor_set_speed(0);
-		left_motor_set_speed(0);
+		chargeActive = true;
+		charge_speed = 0;
 	}
+
+	if(chargeActive)
+		motor_request(MOTOR_CHARGE, charge_speed, charge_speed);
+}
+
+regulator_stats_t getRegulatorStats(){
+	return regulator_stats;
+}
+
+charge_stats_t getChargeStats(){
+	return charge_stats;
 }
 
 void regulator_start(void){
+#if REGULATOR_TRACE
+	static SerialConfig ser_cfg = {TRACE_BAUDRATE, 0, 0, 0};
+	sdStart(&SD3, &ser_cfg);
+#endif
 	chThdCreateStatic(waRegulator, sizeof(waRegulator), NORMALPRIO, Regulator, NULL);
 }
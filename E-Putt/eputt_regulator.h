@@ -1,9 +1,24 @@
 #ifndef PI_REGULATOR_H
 #define PI_REGULATOR_H
 
+//wake-ups of the regulator thread, its reaction time to the camera is measured by the arbiter
+typedef struct {
+	uint16_t wakeups;		//during the last second
+} regulator_stats_t;
+
+//odometry of the last charge, the charge is controlled in distance
+typedef struct {
+	int16_t travelled_mm;		//since the ball was locked
+	int16_t contact_travel_mm;	//travel at which the contact is predicted
+	uint16_t closing_speed;		//[mm/s] from two successive TOF reads, diagnostic only
+	uint16_t contact_time_ms;	//predicted at the last TOF read, diagnostic only
+} charge_stats_t;
+
 //start the PI regulator thread
 void regulator_start(void);
 void regulator_position(bool reset);
 void distance_stop(bool reset);
+regulator_stats_t getRegulatorStats(void);
+charge_stats_t getChargeStats(void);
 
 #endif /* PI_REGULATOR_H */
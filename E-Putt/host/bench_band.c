@@ -0,0 +1,116 @@
+/*
+ * Rows of the band against detection and processing time: the band of NB_CAPTURED_LINES
+ * (set at build time) is rendered with pixel noise, reduced by reduce_band() and searched
+ * by extract_ball_pos(). The ball fills the band, or only its last lines: the band crosses the
+ * top of a near ball low in the image, or of a ball far away at BALL_DIST_MAX_MM.
+ * Prints one row per ball and noise level: detection rate, and the cost of reduce_band() in
+ * cycles of the robot, also as a share of the frame period. Each scene is timed over
+ * BENCH_BATCH calls, BENCH_REPEAT times, the fastest batch is kept and scaled by
+ * m4_cycles_per_ns(), timed again for each row.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "../process_image.c"
+#include "kernel.h"
+#include "render.h"
+#include "m4_calib.h"
+
+#define BENCH_SCENES			400
+#define BENCH_REPEAT			10
+#define BENCH_BATCH			10
+#define BENCH_NB_NOISES		2
+#define BENCH_NB_BALLS		3
+#define BENCH_TOLERANCE_PXL	8
+
+typedef struct {
+	const char *name;
+	uint16_t width;		//[pxl]
+	uint8_t lines_div;	//the ball covers NB_CAPTURED_LINES/lines_div lines...
+	bool low;			//...the last ones, or centered
+} bench_ball_t;
+
+static const bench_ball_t bench_ball[BENCH_NB_BALLS] = {
+	{"full", 90, 1, false},		//at about 300mm
+	{"near", 180, 2, true},		//at about 150mm
+	{"far", 80, 4, true},		//just under BALL_DIST_MAX_MM
+};
+
+//the state machine isn't linked, the band is always analysed
+enum eputtState getState(void){
+	return SEARCH_BALL;
+}
+
+void switchState(bool success){
+	(void)success;
+}
+
+//pixel noise [levels]: good light, then dim light and high gain
+static const float bench_noise[BENCH_NB_NOISES] = {12, 40};
+
+//[ns] per call
+static uint32_t fastest_reduce(const uint8_t *band, uint8_t *profile, uint8_t *goal_profile){
+
+	uint32_t best = UINT32_MAX, t = 0, start = 0;
+
+	for(uint8_t r = 0 ; r < BENCH_REPEAT ; r++)
+	{
+		start = DWT->CYCCNT;
+		for(uint8_t b = 0 ; b < BENCH_BATCH ; b++)
+			reduce_band(band, profile, goal_profile);
+		t = (DWT->CYCCNT - start)/BENCH_BATCH;
+		if(t < best)
+			best = t;
+	}
+	return best;
+}
+
+int main(void){
+
+	static uint8_t band[IMAGE_BUFFER_SIZE*NB_CAPTURED_LINES*2];
+	uint8_t profile[IMAGE_BUFFER_SIZE], goal_profile[IMAGE_BUFFER_SIZE];
+	scene_t scene = {.light = 1};
+	uint16_t found = 0;
+	uint32_t t = 0, max_ns = 0;
+	double total_ns = 0;
+	float cycles_per_ns = 0, readout_ms = NB_CAPTURED_LINES*LINE_TIME_US/1000.0f;
+	float mean_cycles = 0, max_cycles = 0;
+
+	m4_cycles_per_ns(); //the first call warms the host up
+	for(uint8_t b = 0 ; b < BENCH_NB_BALLS ; b++)
+	{
+		scene.ball_lines = NB_CAPTURED_LINES/bench_ball[b].lines_div ? NB_CAPTURED_LINES/bench_ball[b].lines_div : 1;
+		scene.ball_low = bench_ball[b].low;
+		for(uint8_t k = 0 ; k < BENCH_NB_NOISES ; k++)
+		{
+			rng_seed(26);
+			scene.noise = bench_noise[k];
+			found = 0;
+			total_ns = max_ns = 0;
+			for(uint16_t n = 0 ; n < BENCH_SCENES ; n++)
+			{
+				scene.ball_left = rng_uniform(20, IMAGE_BUFFER_SIZE - 20 - bench_ball[b].width);
+				scene.ball_right = scene.ball_left + bench_ball[b].width;
+				render_band(band, IMAGE_BUFFER_SIZE, NB_CAPTURED_LINES, CAPTURE_FORMAT == CAPTURE_FORMAT_YUV422, &scene);
+
+				t = fastest_reduce(band, profile, goal_profile);
+				total_ns += t;
+				if(t > max_ns)
+					max_ns = t;
+
+				extract_ball_pos(profile);
+				if(seenLast && fabsf(ball_position - (scene.ball_left + scene.ball_right)/2) <= BENCH_TOLERANCE_PXL)
+					found++;
+			}
+
+			cycles_per_ns = m4_cycles_per_ns();
+			mean_cycles = total_ns/BENCH_SCENES*cycles_per_ns;
+			max_cycles = max_ns*cycles_per_ns;
+			printf("%5s %5u %5s %5.0f %9.1f%% %10.0f %10.0f %10.2f %8.2f%%\n",
+				   CAPTURE_FORMAT == CAPTURE_FORMAT_YUV422 ? "yuv" : "rgb", NB_CAPTURED_LINES,
+				   bench_ball[b].name, scene.noise, 100.0f*found/BENCH_SCENES, mean_cycles, max_cycles,
+				   readout_ms, 100.0f*max_cycles/(STM32_SYSCLK/1000.0f*FRAME_PERIOD_MS));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Exposure control of process_image.c against the light of the room: the ball is tracked while
+ * the light steps down, each level is held BENCH_SETTLE_MS, then the capture rate and the
+ * detection rate are read over BENCH_MEASURE_MS. The sensor follows camera_model.c.
+ * Built with EXPOSURE_CONTROL=0, the sensor AE runs while tracking, as before the control.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "camera_model.h"
+
+#include <main.h>
+#include <process_image.h>
+
+#define BENCH_SETTLE_MS		2000
+#define BENCH_MEASURE_MS		3000 //whole windows of the rates
+#define BENCH_NB_LIGHTS		7
+#define BENCH_NOISE			4 //sensor noise at the default gains
+#define BALL_LEFT			270 //ball at about 300mm
+#define BALL_RIGHT			360
+
+#ifndef EXPOSURE_CONTROL
+#define EXPOSURE_CONTROL	1 //same default as process_image.c
+#endif
+
+static const float bench_light[BENCH_NB_LIGHTS] = {2, 1, 0.5f, 0.25f, 0.12f, 0.06f, 0.03f};
+static float room_light = 1;
+
+enum eputtState getState(void){
+	return SEARCH_BALL;
+}
+
+void switchState(bool success){
+	(void)success;
+}
+
+static void render(uint8_t *band, uint16_t width, uint16_t lines, bool yuv){
+	scene_t scene = {.ball_left = BALL_LEFT, .ball_right = BALL_RIGHT, .ball_lines = lines};
+	camera_expose(&scene, room_light, BENCH_NOISE);
+	render_band(band, width, lines, yuv, &scene);
+}
+
+static uint16_t frame_period_ms(void){
+	return camera_frame_period_ms(room_light);
+}
+
+static const hw_backend_t backend = {
+	.render = render,
+	.frame_period_ms = frame_period_ms,
+};
+
+int main(void){
+
+	systime_t t = 0;
+	uint16_t fps = 0, detection = 0;
+
+	chSysInit();
+	hw_init(&backend);
+	capture_process_img_start();
+
+	printf("%s: light    fps  detection  exposure  gain\n", EXPOSURE_CONTROL ? "control" : "sensor AE");
+	for(uint8_t k = 0 ; k < BENCH_NB_LIGHTS ; k++)
+	{
+		room_light = bench_light[k];
+		t += MS2ST(BENCH_SETTLE_MS);
+		sim_run_until(t);
+		fps = detection = 0;
+		for(uint16_t w = 0 ; w < BENCH_MEASURE_MS/1000 ; w++)
+		{
+			t += MS2ST(1000);
+			sim_run_until(t);
+			fps += getCaptureFps();
+			detection += getDetectionRate();
+		}
+		printf("%14.2f %6.1f %9u%% %9u %5.2f\n", room_light, fps/(BENCH_MEASURE_MS/1000.0f),
+			   detection/(BENCH_MEASURE_MS/1000), (unsigned)camera_exposure_lines(room_light),
+			   hw_camera().ae ? 1 : (float)hw_camera().gain_r/CAMERA_RED_GAIN_DEFAULT);
+	}
+	return 0;
+}
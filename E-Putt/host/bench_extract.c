@@ -0,0 +1,122 @@
+/*
+ * Execution time of extract_ball_pos() on the worst-case lines of the startup self-test
+ * against rendered scenes and random combs of dips. Each input is timed over BENCH_BATCH calls
+ * (a single call is close to the host clock resolution), BENCH_REPEAT times, and the fastest
+ * batch is kept: that removes the host preemptions like the kernel lock does on the robot.
+ * Prints the median, 99th percentile and maximum, and fails if the maximum, scaled to cycles of
+ * the robot by m4_cycles_per_ns(), is over EXTRACT_BUDGET_CYCLES.
+ * The host predicts branches and the Cortex-M4 doesn't, so noisy scenes can be slower than
+ * the worst-case lines here without being so on the robot; the ratio is only printed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../process_image.c"
+#include "kernel.h"
+#include "render.h"
+#include "m4_calib.h"
+
+#define BENCH_SCENES			2000
+#define BENCH_REPEAT			10
+#define BENCH_BATCH			20
+#define BENCH_COMB_MAX		(2*MIN_OBJ_WIDTH) //widest random dip
+
+enum eputtState getState(void){
+	return SEARCH_BALL;
+}
+
+void switchState(bool success){
+	(void)success;
+}
+
+//[ns] per call
+static uint32_t fastest_extract(uint8_t *profile){
+
+	uint32_t best = UINT32_MAX, t = 0, start = 0;
+
+	for(uint8_t r = 0 ; r < BENCH_REPEAT ; r++)
+	{
+		start = DWT->CYCCNT;
+		for(uint8_t b = 0 ; b < BENCH_BATCH ; b++)
+			extract_ball_pos(profile);
+		t = (DWT->CYCCNT - start)/BENCH_BATCH;
+		if(t < best)
+			best = t;
+	}
+	return best;
+}
+
+static int compare_u32(const void *a, const void *b){
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+//random dips of random widths, most of them rejected as too narrow
+static void random_comb(uint8_t *profile){
+
+	uint16_t i = 0, width = 0;
+	bool low = false;
+
+	while(i < IMAGE_BUFFER_SIZE)
+	{
+		width = rng_uniform(WIDTH_SLOPE, BENCH_COMB_MAX);
+		for(uint16_t k = 0 ; k < width && i < IMAGE_BUFFER_SIZE ; k++, i++)
+			profile[i] = low ? rng_uniform(0, WCET_LOW) : rng_uniform(WCET_HIGH - 40, WCET_HIGH);
+		low = !low;
+	}
+}
+
+int main(void){
+
+	static uint8_t band[IMAGE_BUFFER_SIZE*NB_CAPTURED_LINES*2];
+	static uint32_t scene_ns[BENCH_SCENES];
+	uint8_t profile[IMAGE_BUFFER_SIZE], goal_profile[IMAGE_BUFFER_SIZE];
+	scene_t scene = {.ball_lines = NB_CAPTURED_LINES, .light = 1};
+	uint32_t worst_ns = 0, t = 0, max_ns = 0, max_cycles = 0;
+	float cycles_per_ns = 0;
+	uint16_t width = 0;
+
+	printf("extract: line, fastest of %u batches [ns per call]\n", BENCH_REPEAT);
+	for(uint8_t kind = 0 ; kind < WCET_NB_LINES ; kind++)
+	{
+		worst_case_line(profile, kind);
+		t = fastest_extract(profile);
+		printf("  worst-case line %u %8u\n", kind, t);
+		if(t > worst_ns)
+			worst_ns = t;
+	}
+
+	rng_seed(30);
+	for(uint16_t n = 0 ; n < BENCH_SCENES ; n++)
+	{
+		if(n % 2)
+			random_comb(profile);
+		else
+		{
+			width = rng_uniform(MIN_OBJ_WIDTH/2, 3*MIN_OBJ_WIDTH);
+			scene.ball_left = rng_uniform(0, IMAGE_BUFFER_SIZE - width);
+			scene.ball_right = scene.ball_left + width;
+			scene.noise = rng_uniform(5, 50);
+			render_band(band, IMAGE_BUFFER_SIZE, NB_CAPTURED_LINES, CAPTURE_FORMAT == CAPTURE_FORMAT_YUV422, &scene);
+			reduce_band(band, profile, goal_profile);
+		}
+		scene_ns[n] = fastest_extract(profile);
+	}
+	qsort(scene_ns, BENCH_SCENES, sizeof(scene_ns[0]), compare_u32);
+
+	max_ns = scene_ns[BENCH_SCENES - 1] > worst_ns ? scene_ns[BENCH_SCENES - 1] : worst_ns;
+	cycles_per_ns = m4_cycles_per_ns();
+	max_cycles = max_ns*cycles_per_ns;
+
+	printf("  scenes p50 %u p99 %u max %u, worst-case lines %u (scenes max / lines %.2f)\n",
+		   scene_ns[BENCH_SCENES/2], scene_ns[BENCH_SCENES*99/100], scene_ns[BENCH_SCENES - 1],
+		   worst_ns, (double)scene_ns[BENCH_SCENES - 1]/worst_ns);
+	printf("  %.1f M4 cycles per host ns: max %u cycles on the robot, budget %u (%.0f%%)\n",
+		   cycles_per_ns, max_cycles, EXTRACT_BUDGET_CYCLES, 100.0*max_cycles/EXTRACT_BUDGET_CYCLES);
+	if(max_cycles > EXTRACT_BUDGET_CYCLES)
+	{
+		printf("FAIL: extract_ball_pos over budget\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
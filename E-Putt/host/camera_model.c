@@ -0,0 +1,32 @@
+/*
+ * Exposure of the PO8030 on the host: the light reaching the band is the room light times the
+ * exposure and the digital gain, the gain amplifies the noise as much as the signal. A frame
+ * lasts at least HW_FRAME_PERIOD_MS, longer when the exposure doesn't fit in it.
+ */
+#include "camera_model.h"
+
+float camera_exposure_lines(float room_light){
+
+	hw_camera_t camera = hw_camera();
+	float lines = CAMERA_EXPOSURE_REF/room_light;
+
+	if(!camera.ae)
+		return camera.exposure;
+	return lines < CAMERA_AE_EXPOSURE_MAX ? lines : CAMERA_AE_EXPOSURE_MAX;
+}
+
+void camera_expose(scene_t *scene, float room_light, float noise){
+
+	hw_camera_t camera = hw_camera();
+	float gain = camera.ae ? 1 : (float)camera.gain_r/CAMERA_RED_GAIN_DEFAULT;
+
+	scene->light = room_light*camera_exposure_lines(room_light)/CAMERA_EXPOSURE_REF*gain;
+	scene->noise = noise*gain;
+}
+
+uint16_t camera_frame_period_ms(float room_light){
+
+	uint16_t period = camera_exposure_lines(room_light)*CAMERA_LINE_US/1000;
+
+	return period > HW_FRAME_PERIOD_MS ? period : HW_FRAME_PERIOD_MS;
+}
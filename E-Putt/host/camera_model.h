@@ -0,0 +1,22 @@
+#ifndef CAMERA_MODEL_H
+#define CAMERA_MODEL_H
+
+#include "hw.h"
+#include "render.h"
+
+//Response of the PO8030 to the light of the room, from the settings the firmware wrote.
+//A room light of 1 gives a well exposed frame at CAMERA_EXPOSURE_REF lines and the default
+//gains. With its AE, the sensor lengthens the exposure, and the frames, to expose the same.
+#define CAMERA_EXPOSURE_REF		300 //[lines]
+#define CAMERA_LINE_US			127
+#define CAMERA_AE_EXPOSURE_MAX	4000 //[lines], then the frame stays dark
+#define CAMERA_RED_GAIN_DEFAULT	0x5E
+
+//exposure [lines] the sensor integrates with the settings written by the firmware
+float camera_exposure_lines(float room_light);
+//brightness and noise of the band for a room light and the sensor noise at the default gains
+void camera_expose(scene_t *scene, float room_light, float noise);
+//frame period of the sensor [ms]
+uint16_t camera_frame_period_ms(float room_light);
+
+#endif /* CAMERA_MODEL_H */
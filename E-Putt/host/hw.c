@@ -0,0 +1,428 @@
+/*
+ * Devices of the e-puck2 library on the kernel shim: motors, camera and DCMI, VL53L0X,
+ * IR proximity, IMU, leds, serial trace. The motors integrate their steps each tick,
+ * the sensors publish at their own rate, everything sensed comes from the backend.
+ */
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal.h"
+#include "kernel.h"
+#include "hw.h"
+
+#include <motors.h>
+#include <leds.h>
+#include <chprintf.h>
+#include <memory_protection.h>
+#include <i2c_bus.h>
+#include <camera/po8030.h>
+#include <camera/dcmi_camera.h>
+#include <msgbus/messagebus.h>
+#include <sensors/proximity.h>
+#include <sensors/imu.h>
+#include <sensors/VL53L0X/VL53L0X.h>
+
+#define IMAGE_MAX_BYTES		(640*16*2)
+
+messagebus_t bus;
+SerialDriver SD3;
+CoreDebug_Type hw_core_debug;
+FILE *hw_trace_file = NULL;
+
+static const hw_backend_t *hw = NULL;
+static virtual_timer_t tick_timer, imu_timer, prox_timer, frame_timer;
+
+static int16_t left_speed = 0, right_speed = 0;
+static float left_pos = 0, right_pos = 0;
+static uint32_t motor_writes = 0;
+static uint8_t leds = 0;
+
+static hw_camera_t camera;
+static uint8_t image[IMAGE_MAX_BYTES];
+static uint8_t image_ready = 0;
+static bool capturing = false;
+static binary_semaphore_t image_ready_sem;
+static uint32_t frames_done = 0, frames_started = 0;
+
+static messagebus_topic_t prox_topic, imu_topic;
+static proximity_msg_t prox_value;
+static imu_msg_t imu_value;
+static bool prox_started = false, imu_started = false;
+
+static void tick(void *arg){
+
+	const float dt = HW_TICK_MS/1000.0f;
+
+	(void)arg;
+	left_pos += left_speed*dt;
+	right_pos += right_speed*dt;
+	if(hw->step)
+		hw->step(dt);
+	chVTSetI(&tick_timer, MS2ST(HW_TICK_MS), tick, NULL);
+}
+
+static void prox_publish(void *arg){
+
+	proximity_msg_t msg;
+
+	(void)arg;
+	memset(&msg, 0, sizeof(msg));
+	for(uint8_t i = 0 ; i < PROXIMITY_NB_CHANNELS ; i++)
+	{
+		msg.initValue[i] = HW_PROX_INIT;
+		msg.delta[i] = HW_PROX_INIT + get_calibrated_prox(i);
+	}
+	messagebus_topic_publish(&prox_topic, &msg, sizeof(msg));
+	chVTSetI(&prox_timer, MS2ST(HW_PROX_PERIOD_MS), prox_publish, NULL);
+}
+
+static void imu_publish(void *arg){
+
+	imu_msg_t msg;
+
+	(void)arg;
+	memset(&msg, 0, sizeof(msg));
+	msg.acceleration[Z_AXIS] = 9.81f;
+	msg.gyro_rate[Z_AXIS] = hw->gyro_z ? hw->gyro_z() : 0;
+	messagebus_topic_publish(&imu_topic, &msg, sizeof(msg));
+	chVTSetI(&imu_timer, US2ST(HW_IMU_PERIOD_US), imu_publish, NULL);
+}
+
+void hw_init(const hw_backend_t *backend){
+
+	static const hw_backend_t none = {0};
+
+	hw = backend ? backend : &none;
+	messagebus_init(&bus, NULL, NULL);
+	left_speed = right_speed = 0;
+	left_pos = right_pos = 0;
+	motor_writes = 0;
+	leds = 0;
+	memset(&camera, 0, sizeof(camera));
+	camera.ae = true;
+	image_ready = 0;
+	capturing = false;
+	frames_done = frames_started = 0;
+	chBSemObjectInit(&image_ready_sem, true);
+	prox_started = imu_started = false;
+
+	chVTObjectInit(&tick_timer);
+	chVTObjectInit(&imu_timer);
+	chVTObjectInit(&prox_timer);
+	chVTObjectInit(&frame_timer);
+	chVTSetI(&tick_timer, MS2ST(HW_TICK_MS), tick, NULL);
+}
+
+int16_t hw_left_speed(void){
+	return left_speed;
+}
+
+int16_t hw_right_speed(void){
+	return right_speed;
+}
+
+uint32_t hw_motor_writes(void){
+	return motor_writes;
+}
+
+hw_camera_t hw_camera(void){
+	return camera;
+}
+
+uint8_t hw_leds(void){
+	return leds;
+}
+
+uint32_t hw_frames_done(void){
+	return frames_done;
+}
+
+uint32_t hw_frames_started(void){
+	return frames_started;
+}
+
+/*===========================================================================*/
+/* System                                                                    */
+/*===========================================================================*/
+
+void halInit(void){
+}
+
+void mpu_init(void){
+}
+
+void i2c_start(void){
+}
+
+DWT_Type *hw_dwt(void){
+
+	static DWT_Type dwt;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	dwt.CYCCNT = (uint32_t)(ts.tv_sec*1000000000ULL + ts.tv_nsec);
+	return &dwt;
+}
+
+void sdStart(SerialDriver *sdp, const SerialConfig *config){
+	(void)sdp;
+	(void)config;
+}
+
+int chprintf(BaseSequentialStream *chp, const char *fmt, ...){
+
+	va_list ap;
+	int n = 0;
+
+	(void)chp;
+	if(hw_trace_file == NULL)
+		return 0;
+	va_start(ap, fmt);
+	n = vfprintf(hw_trace_file, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+/*===========================================================================*/
+/* Motors and leds                                                           */
+/*===========================================================================*/
+
+static int16_t motor_limit(int speed){
+	if(speed > MOTOR_SPEED_LIMIT)
+		return MOTOR_SPEED_LIMIT;
+	else if(speed < -MOTOR_SPEED_LIMIT)
+		return -MOTOR_SPEED_LIMIT;
+	return speed;
+}
+
+void motors_init(void){
+}
+
+void left_motor_set_speed(int speed){
+	left_speed = motor_limit(speed);
+	motor_writes++;
+}
+
+void right_motor_set_speed(int speed){
+	right_speed = motor_limit(speed);
+	motor_writes++;
+}
+
+int32_t left_motor_get_pos(void){
+	return (int32_t)left_pos;
+}
+
+int32_t right_motor_get_pos(void){
+	return (int32_t)right_pos;
+}
+
+static void led_write(uint8_t bit, unsigned int value){
+	if(value == 2) //toggle
+		leds ^= bit;
+	else if(value)
+		leds |= bit;
+	else
+		leds &= ~bit;
+}
+
+void set_led(led_name_t led_number, unsigned int value){
+	if(led_number < NUM_LED)
+		led_write(1 << led_number, value);
+}
+
+void set_front_led(unsigned int value){
+	led_write(HW_FRONT, value);
+}
+
+void set_body_led(unsigned int value){
+	led_write(HW_BODY, value);
+}
+
+void clear_leds(void){
+	leds &= ~(HW_LED1 | HW_LED3 | HW_LED5 | HW_LED7);
+}
+
+/*===========================================================================*/
+/* Camera                                                                    */
+/*===========================================================================*/
+
+void po8030_start(void){
+}
+
+int8_t po8030_advanced_config(format_t fmt, unsigned int x1, unsigned int y1, unsigned int width,
+							  unsigned int height, subsampling_t subsampling_x, subsampling_t subsampling_y){
+	(void)x1;
+	(void)y1;
+	(void)subsampling_x;
+	(void)subsampling_y;
+	if(width*height*2 > IMAGE_MAX_BYTES)
+		return -1;
+	camera.yuv = (fmt == FORMAT_YCBYCR);
+	camera.width = width;
+	camera.lines = height;
+	return 0;
+}
+
+int8_t po8030_set_ae(uint8_t ae){
+	camera.ae = ae;
+	return 0;
+}
+
+int8_t po8030_set_awb(uint8_t awb){
+	(void)awb;
+	return 0;
+}
+
+int8_t po8030_set_exposure(uint16_t integral, uint8_t fractional){
+	(void)fractional;
+	camera.exposure = integral;
+	return 0;
+}
+
+int8_t po8030_set_rgb_gain(uint8_t r, uint8_t g, uint8_t b){
+	camera.gain_r = r;
+	camera.gain_g = g;
+	camera.gain_b = b;
+	return 0;
+}
+
+void dcmi_start(void){
+}
+
+int8_t dcmi_prepare(void){
+	return 0;
+}
+
+void dcmi_unprepare(void){
+}
+
+void dcmi_set_capture_mode(capture_mode_t mode){
+	(void)mode;
+}
+
+void dcmi_enable_double_buffering(void){
+}
+
+void dcmi_disable_double_buffering(void){
+}
+
+void dcmi_release(void){
+}
+
+//end of the DMA transfer, ISR context
+static void frame_end(void *arg){
+	(void)arg;
+	if(hw->render)
+		hw->render(image, camera.width, camera.lines, camera.yuv);
+	capturing = false;
+	image_ready = 1;
+	frames_done++;
+	chBSemSignalI(&image_ready_sem);
+}
+
+int8_t dcmi_capture_start(void){
+
+	uint16_t period = hw->frame_period_ms ? hw->frame_period_ms() : HW_FRAME_PERIOD_MS;
+	systime_t now = chVTGetSystemTime();
+
+	image_ready = 0;
+	capturing = true;
+	frames_started++;
+	if(hw->frame_lost && hw->frame_lost())
+		return 0;
+
+	//the capture starts with the next frame of the sensor, which runs continuously
+	chVTSetI(&frame_timer, MS2ST((period - now % period) % period + period), frame_end, NULL);
+	return 0;
+}
+
+msg_t dcmi_capture_stop(void){
+	chVTResetI(&frame_timer);
+	capturing = false;
+	return MSG_OK;
+}
+
+uint8_t image_is_ready(void){
+	return image_ready;
+}
+
+void wait_image_ready(void){
+	chBSemWait(&image_ready_sem);
+}
+
+uint8_t *dcmi_get_last_image_ptr(void){
+	return image;
+}
+
+/*===========================================================================*/
+/* Sensors                                                                   */
+/*===========================================================================*/
+
+void proximity_start(void){
+	if(prox_started)
+		return;
+	prox_started = true;
+	messagebus_topic_init(&prox_topic, NULL, NULL, &prox_value, sizeof(prox_value));
+	messagebus_advertise_topic(&bus, &prox_topic, "/proximity");
+	chVTSetI(&prox_timer, MS2ST(HW_PROX_PERIOD_MS), prox_publish, NULL);
+}
+
+void calibrate_ir(void){
+}
+
+int get_calibrated_prox(unsigned int sensor_number){
+	return hw->prox ? hw->prox(sensor_number) : 0;
+}
+
+int get_prox(unsigned int sensor_number){
+	return HW_PROX_INIT + get_calibrated_prox(sensor_number);
+}
+
+int get_ambient_light(unsigned int sensor_number){
+	(void)sensor_number;
+	return 0;
+}
+
+void imu_start(void){
+	if(imu_started)
+		return;
+	imu_started = true;
+	messagebus_topic_init(&imu_topic, NULL, NULL, &imu_value, sizeof(imu_value));
+	messagebus_advertise_topic(&bus, &imu_topic, "/imu");
+	chVTSetI(&imu_timer, US2ST(HW_IMU_PERIOD_US), imu_publish, NULL);
+}
+
+void calibrate_gyro(void){
+}
+
+float get_gyro_rate(uint8_t axis){
+	return (axis == Z_AXIS && hw->gyro_z) ? hw->gyro_z() : 0;
+}
+
+VL53L0X_Error VL53L0X_init(VL53L0X_Dev_t *device){
+	memset(&device->Data, 0, sizeof(device->Data));
+	return VL53L0X_ERROR_NONE;
+}
+
+VL53L0X_Error VL53L0X_configAccuracy(VL53L0X_Dev_t *device, VL53L0X_AccuracyMode accuracy){
+	(void)device;
+	(void)accuracy;
+	return VL53L0X_ERROR_NONE;
+}
+
+VL53L0X_Error VL53L0X_startMeasure(VL53L0X_Dev_t *device, VL53L0X_DeviceModes mode){
+	(void)device;
+	(void)mode;
+	return VL53L0X_ERROR_NONE;
+}
+
+VL53L0X_Error VL53L0X_stopMeasure(VL53L0X_Dev_t *device){
+	(void)device;
+	return VL53L0X_ERROR_NONE;
+}
+
+VL53L0X_Error VL53L0X_getLastMeasure(VL53L0X_Dev_t *device){
+	device->Data.LastRangeMeasure.RangeMilliMeter = hw->tof_mm ? hw->tof_mm() : HW_TOF_NO_TARGET;
+	return VL53L0X_ERROR_NONE;
+}
@@ -0,0 +1,73 @@
+#ifndef HW_H
+#define HW_H
+
+#include <stdio.h>
+
+#include "ch.h"
+
+//Devices of the e-puck2 on the host, driven by the virtual clock. What they sense comes
+//from a backend: a stub in the unit tests, the plant model in the simulator.
+#define HW_TICK_MS			1
+#ifndef HW_IMU_PERIOD_US
+#define HW_IMU_PERIOD_US		4000 //the library IMU thread samples at 250Hz
+#endif
+#define HW_PROX_PERIOD_MS	10 //the proximity sensors are sampled at 100Hz
+#define HW_FRAME_PERIOD_MS	66 //used without a frame_period_ms hook
+#define HW_TOF_NO_TARGET		8190 //range returned by the VL53L0X without a target
+#define HW_PROX_INIT			200 //ambient offset of the proximity messages
+
+//every hook can be NULL
+typedef struct {
+	//each HW_TICK_MS, once the wheels have moved
+	void (*step)(float dt);
+	//fills a captured band at the end of its frame, in the configured format
+	void (*render)(uint8_t *band, uint16_t width, uint16_t lines, bool yuv);
+	//duration of a frame with the current exposure
+	uint16_t (*frame_period_ms)(void);
+	//asked at each capture start, true to never complete this one
+	bool (*frame_lost)(void);
+	//raw range of each VL53L0X read [mm]
+	uint16_t (*tof_mm)(void);
+	//calibrated reading of an IR proximity sensor
+	int (*prox)(uint8_t sensor);
+	//yaw rate [rad/s], calibrated
+	float (*gyro_z)(void);
+} hw_backend_t;
+
+//camera settings written by the firmware
+typedef struct {
+	bool yuv;			//FORMAT_YCBYCR, RGB565 otherwise
+	uint16_t width;
+	uint16_t lines;
+	bool ae;			//sensor auto exposure
+	uint16_t exposure;	//[lines], when ae is off
+	uint8_t gain_r;
+	uint8_t gain_g;
+	uint8_t gain_b;
+} hw_camera_t;
+
+//leds as bits, same order as the SEQ_xxx of led_sequencer.h
+#define HW_LED1				(1 << 0)
+#define HW_LED3				(1 << 1)
+#define HW_LED5				(1 << 2)
+#define HW_LED7				(1 << 3)
+#define HW_FRONT				(1 << 4)
+#define HW_BODY				(1 << 5)
+
+//resets the devices and starts their timers, after chSysInit()
+void hw_init(const hw_backend_t *backend);
+//wheel speeds applied by the motor driver [steps/s]
+int16_t hw_left_speed(void);
+int16_t hw_right_speed(void);
+//calls to the motor driver
+uint32_t hw_motor_writes(void);
+hw_camera_t hw_camera(void);
+uint8_t hw_leds(void);
+//captures completed and started
+uint32_t hw_frames_done(void);
+uint32_t hw_frames_started(void);
+
+//destination of chprintf, the regulator trace (REGULATOR_TRACE)
+extern FILE *hw_trace_file;
+
+#endif /* HW_H */
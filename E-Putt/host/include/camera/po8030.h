@@ -0,0 +1,29 @@
+#ifndef PO8030_H
+#define PO8030_H
+
+#include <stdint.h>
+
+typedef enum {
+	FORMAT_CBYCRY = 0x00,
+	FORMAT_CRYCBY = 0x01,
+	FORMAT_YCBYCR = 0x02,
+	FORMAT_YCRYCB = 0x03,
+	FORMAT_RGB565 = 0x30,
+	FORMAT_YYYY = 0x44,
+} format_t;
+
+typedef enum {
+	SUBSAMPLING_X1 = 0x20,
+	SUBSAMPLING_X2 = 0x40,
+	SUBSAMPLING_X4 = 0x80,
+} subsampling_t;
+
+void po8030_start(void);
+int8_t po8030_advanced_config(format_t fmt, unsigned int x1, unsigned int y1, unsigned int width,
+							  unsigned int height, subsampling_t subsampling_x, subsampling_t subsampling_y);
+int8_t po8030_set_ae(uint8_t ae);
+int8_t po8030_set_awb(uint8_t awb);
+int8_t po8030_set_exposure(uint16_t integral, uint8_t fractional);
+int8_t po8030_set_rgb_gain(uint8_t r, uint8_t g, uint8_t b);
+
+#endif /* PO8030_H */
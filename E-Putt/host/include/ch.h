@@ -0,0 +1,198 @@
+/*
+ * Host shim of the ChibiOS/RT 3 kernel API used by the E-Putt sources.
+ * Implemented by kernel.c: cooperative threads scheduled by priority on a virtual clock,
+ * so the firmware threads run unmodified and much faster than real time.
+ */
+#ifndef CH_H
+#define CH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifndef CH_CFG_ST_FREQUENCY
+#define CH_CFG_ST_FREQUENCY		1000 //as in chconf.h, other rates are tested too
+#endif
+
+typedef uint32_t systime_t;
+typedef int32_t msg_t;
+typedef int32_t cnt_t;
+typedef uint32_t tprio_t;
+typedef uint32_t eventmask_t;
+typedef uint32_t eventflags_t;
+
+#define MSG_OK				((msg_t)0)
+#define MSG_TIMEOUT			((msg_t)-1)
+#define MSG_RESET			((msg_t)-2)
+#define TIME_IMMEDIATE		((systime_t)0)
+#define TIME_INFINITE		((systime_t)-1)
+
+#define IDLEPRIO				((tprio_t)1)
+#define LOWPRIO				((tprio_t)2)
+#define NORMALPRIO			((tprio_t)128)
+#define HIGHPRIO				((tprio_t)255)
+
+#define ALL_EVENTS			((eventmask_t)-1)
+#define EVENT_MASK(eid)		((eventmask_t)1 << (eventmask_t)(eid))
+
+//same rounding as ChibiOS: up to the next tick
+#define S2ST(sec)			((systime_t)((uint32_t)(sec)*(uint32_t)CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec)			((systime_t)(((uint32_t)(msec)*(uint32_t)CH_CFG_ST_FREQUENCY + 999UL)/1000UL))
+#define US2ST(usec)			((systime_t)(((uint32_t)(usec)*(uint32_t)CH_CFG_ST_FREQUENCY + 999999UL)/1000000UL))
+#define ST2MS(n)				(((uint32_t)(n)*1000UL + CH_CFG_ST_FREQUENCY - 1UL)/CH_CFG_ST_FREQUENCY)
+#define ST2US(n)				(((uint32_t)(n)*1000000UL + CH_CFG_ST_FREQUENCY - 1UL)/CH_CFG_ST_FREQUENCY)
+
+/*===========================================================================*/
+/* Threads                                                                   */
+/*===========================================================================*/
+
+typedef struct ch_thread thread_t;
+typedef void (*tfunc_t)(void *arg);
+
+//the host threads get their own stack, the working area only keeps the declarations compiling
+#define THD_WORKING_AREA(s, n)		uint8_t s[n]
+#define THD_FUNCTION(tname, arg)	void tname(void *arg)
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg);
+thread_t *chThdGetSelfX(void);
+tprio_t chThdGetPriorityX(void);
+void chRegSetThreadName(const char *name);
+void chThdSleep(systime_t time);
+void chThdSleepUntil(systime_t time);
+void chThdSleepUntilWindowed(systime_t prev, systime_t next);
+void chThdYield(void);
+#define chThdSleepSeconds(sec)			chThdSleep(S2ST(sec))
+#define chThdSleepMilliseconds(msec)	chThdSleep(MS2ST(msec))
+#define chThdSleepMicroseconds(usec)	chThdSleep(US2ST(usec))
+
+systime_t chVTGetSystemTime(void);
+#define chVTGetSystemTimeX()			chVTGetSystemTime()
+#define chVTTimeElapsedSinceX(start)	(chVTGetSystemTime() - (start))
+
+/*===========================================================================*/
+/* System                                                                    */
+/*===========================================================================*/
+
+void chSysInit(void);
+void chSysHalt(const char *reason);
+void chSysLock(void);
+void chSysUnlock(void);
+#define chSysLockFromISR()		chSysLock()
+#define chSysUnlockFromISR()		chSysUnlock()
+#define chDbgAssert(c, r)		do { if(!(c)) chSysHalt(r); } while(0)
+
+/*===========================================================================*/
+/* Virtual timers                                                            */
+/*===========================================================================*/
+
+typedef void (*vtfunc_t)(void *par);
+
+typedef struct ch_virtual_timer {
+	struct ch_virtual_timer *next;
+	systime_t deadline;
+	vtfunc_t func;
+	void *par;
+	bool armed;
+} virtual_timer_t;
+
+void chVTObjectInit(virtual_timer_t *vtp);
+void chVTSetI(virtual_timer_t *vtp, systime_t delay, vtfunc_t vtfunc, void *par);
+void chVTResetI(virtual_timer_t *vtp);
+bool chVTIsArmedI(virtual_timer_t *vtp);
+#define chVTSet(vtp, delay, vtfunc, par)	chVTSetI(vtp, delay, vtfunc, par)
+#define chVTReset(vtp)					chVTResetI(vtp)
+
+/*===========================================================================*/
+/* Events                                                                    */
+/*===========================================================================*/
+
+typedef struct event_listener {
+	struct event_listener *next;
+	thread_t *listener;
+	eventmask_t events;
+} event_listener_t;
+
+typedef struct event_source {
+	event_listener_t *next;
+} event_source_t;
+
+#define _EVENTSOURCE_DATA(name)		{NULL}
+#define EVENTSOURCE_DECL(name)		event_source_t name = _EVENTSOURCE_DATA(name)
+
+void chEvtObjectInit(event_source_t *esp);
+void chEvtRegisterMask(event_source_t *esp, event_listener_t *elp, eventmask_t events);
+void chEvtUnregister(event_source_t *esp, event_listener_t *elp);
+void chEvtBroadcastI(event_source_t *esp);
+void chEvtBroadcast(event_source_t *esp);
+void chEvtSignal(thread_t *tp, eventmask_t events);
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t time);
+#define chEvtWaitAny(events)			chEvtWaitAnyTimeout(events, TIME_INFINITE)
+
+/*===========================================================================*/
+/* Mailboxes and semaphores                                                  */
+/*===========================================================================*/
+
+typedef struct {
+	msg_t *buffer;
+	cnt_t size;
+	cnt_t rd;
+	cnt_t cnt;
+} mailbox_t;
+
+#define _MAILBOX_DATA(name, buffer, size)	{(msg_t *)(buffer), (size), 0, 0}
+#define MAILBOX_DECL(name, buffer, size)		mailbox_t name = _MAILBOX_DATA(name, buffer, size)
+
+void chMBObjectInit(mailbox_t *mbp, msg_t *buf, cnt_t n);
+void chMBReset(mailbox_t *mbp);
+msg_t chMBPost(mailbox_t *mbp, msg_t msg, systime_t timeout);
+msg_t chMBPostI(mailbox_t *mbp, msg_t msg);
+msg_t chMBFetch(mailbox_t *mbp, msg_t *msgp, systime_t timeout);
+msg_t chMBFetchI(mailbox_t *mbp, msg_t *msgp);
+cnt_t chMBGetUsedCountI(mailbox_t *mbp);
+cnt_t chMBGetFreeCountI(mailbox_t *mbp);
+
+typedef struct {
+	cnt_t cnt;
+} semaphore_t;
+
+typedef struct {
+	semaphore_t sem;
+} binary_semaphore_t;
+
+#define _SEMAPHORE_DATA(name, n)		{(n)}
+#define SEMAPHORE_DECL(name, n)		semaphore_t name = _SEMAPHORE_DATA(name, n)
+#define _BSEMAPHORE_DATA(name, taken)	{_SEMAPHORE_DATA(name.sem, ((taken) ? 0 : 1))}
+#define BSEMAPHORE_DECL(name, taken)	binary_semaphore_t name = _BSEMAPHORE_DATA(name, taken)
+
+void chSemObjectInit(semaphore_t *sp, cnt_t n);
+msg_t chSemWaitTimeout(semaphore_t *sp, systime_t time);
+void chSemSignal(semaphore_t *sp);
+void chSemSignalI(semaphore_t *sp);
+#define chSemWait(sp)				chSemWaitTimeout(sp, TIME_INFINITE)
+
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken);
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t time);
+void chBSemSignal(binary_semaphore_t *bsp);
+void chBSemSignalI(binary_semaphore_t *bsp);
+void chBSemReset(binary_semaphore_t *bsp, bool taken);
+#define chBSemWait(bsp)				chBSemWaitTimeout(bsp, TIME_INFINITE)
+
+/*===========================================================================*/
+/* Mutexes and condition variables, only declared by the message bus users  */
+/*===========================================================================*/
+
+typedef struct {
+	int unused;
+} mutex_t;
+
+typedef struct {
+	int unused;
+} condition_variable_t;
+
+#define MUTEX_DECL(name)				mutex_t name = {0}
+#define CONDVAR_DECL(name)			condition_variable_t name = {0}
+#define chMtxLock(mp)				((void)(mp))
+#define chMtxUnlock(mp)				((void)(mp))
+
+#endif /* CH_H */
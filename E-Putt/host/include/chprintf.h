@@ -0,0 +1,13 @@
+#ifndef CHPRINTF_H
+#define CHPRINTF_H
+
+#include <stdarg.h>
+
+typedef struct {
+	int unused;
+} BaseSequentialStream;
+
+//every stream writes to the file set by the host (hw_trace_file), nothing if none
+int chprintf(BaseSequentialStream *chp, const char *fmt, ...);
+
+#endif /* CHPRINTF_H */
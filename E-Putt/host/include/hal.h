@@ -0,0 +1,45 @@
+/*
+ * Host shim of the ChibiOS HAL parts used by the E-Putt sources.
+ */
+#ifndef HAL_H
+#define HAL_H
+
+#include "ch.h"
+
+#define STM32_SYSCLK		168000000
+
+//DWT cycle counter: on the host it counts nanoseconds of the host clock, read on each access
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+DWT_Type *hw_dwt(void);
+extern CoreDebug_Type hw_core_debug;
+#define DWT							(hw_dwt())
+#define CoreDebug					(&hw_core_debug)
+#define CoreDebug_DEMCR_TRCENA_Msk	(1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk		(1UL << 0)
+
+//serial port: the regulator trace goes to the file set by the host (hw_trace_file)
+typedef struct {
+	uint32_t speed;
+	uint16_t cr1;
+	uint16_t cr2;
+	uint16_t cr3;
+} SerialConfig;
+
+typedef struct {
+	int unused;
+} SerialDriver;
+
+extern SerialDriver SD3;
+
+void halInit(void);
+void sdStart(SerialDriver *sdp, const SerialConfig *config);
+
+#endif /* HAL_H */
@@ -0,0 +1,6 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+void i2c_start(void);
+
+#endif /* I2C_BUS_H */
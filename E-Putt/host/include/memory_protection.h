@@ -0,0 +1,6 @@
+#ifndef MEMORY_PROTECTION_H
+#define MEMORY_PROTECTION_H
+
+void mpu_init(void);
+
+#endif /* MEMORY_PROTECTION_H */
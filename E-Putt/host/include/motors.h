@@ -0,0 +1,14 @@
+#ifndef MOTORS_H
+#define MOTORS_H
+
+#include <stdint.h>
+
+#define MOTOR_SPEED_LIMIT	1100 //[step/s]
+
+void motors_init(void);
+void left_motor_set_speed(int speed);
+void right_motor_set_speed(int speed);
+int32_t left_motor_get_pos(void);
+int32_t right_motor_get_pos(void);
+
+#endif /* MOTORS_H */
@@ -0,0 +1,36 @@
+/*
+ * Host shim of the e-puck2 message bus, implemented by messagebus.c on the kernel shim.
+ */
+#ifndef MESSAGEBUS_H
+#define MESSAGEBUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOPIC_NAME_MAX_LENGTH	64
+
+typedef struct topic_s {
+	void *buffer;
+	size_t buffer_len;
+	char name[TOPIC_NAME_MAX_LENGTH + 1];
+	struct topic_s *next;
+	uint32_t seq;		//incremented on each publish
+	bool published;
+} messagebus_topic_t;
+
+typedef struct {
+	messagebus_topic_t *topics;
+} messagebus_t;
+
+void messagebus_init(messagebus_t *bus, void *lock, void *condvar);
+void messagebus_topic_init(messagebus_topic_t *topic, void *topic_lock, void *topic_condvar,
+						   void *buffer, size_t buffer_len);
+void messagebus_advertise_topic(messagebus_t *bus, messagebus_topic_t *topic, const char *name);
+messagebus_topic_t *messagebus_find_topic(messagebus_t *bus, const char *name);
+messagebus_topic_t *messagebus_find_topic_blocking(messagebus_t *bus, const char *name);
+bool messagebus_topic_publish(messagebus_topic_t *topic, const void *buf, size_t buf_len);
+bool messagebus_topic_read(messagebus_topic_t *topic, void *buf, size_t buf_len);
+void messagebus_topic_wait(messagebus_topic_t *topic, void *buf, size_t buf_len);
+
+#endif /* MESSAGEBUS_H */
@@ -0,0 +1,8 @@
+#ifndef PARAMETER_H
+#define PARAMETER_H
+
+typedef struct {
+	int unused;
+} parameter_namespace_t;
+
+#endif /* PARAMETER_H */
@@ -0,0 +1,40 @@
+#ifndef VL53L0X_H
+#define VL53L0X_H
+
+#include <stdint.h>
+
+#define VL53L0X_ADDR							0x29
+#define VL53L0X_ERROR_NONE					((VL53L0X_Error)0)
+#define VL53L0X_ERROR_CONTROL_INTERFACE		((VL53L0X_Error)-20)
+#define VL53L0X_DEVICEMODE_SINGLE_RANGING		((VL53L0X_DeviceModes)0)
+#define VL53L0X_DEVICEMODE_CONTINUOUS_RANGING	((VL53L0X_DeviceModes)1)
+
+typedef int8_t VL53L0X_Error;
+typedef uint8_t VL53L0X_DeviceModes;
+
+typedef enum {
+	VL53L0X_DEFAULT_MODE = 0,
+	VL53L0X_HIGH_ACCURACY,
+	VL53L0X_LONG_RANGE,
+	VL53L0X_HIGH_SPEED,
+} VL53L0X_AccuracyMode;
+
+typedef struct {
+	uint16_t RangeMilliMeter;
+	uint8_t RangeStatus;
+} VL53L0X_RangingMeasurementData_t;
+
+typedef struct {
+	struct {
+		VL53L0X_RangingMeasurementData_t LastRangeMeasure;
+	} Data;
+	uint8_t I2cDevAddr;
+} VL53L0X_Dev_t;
+
+VL53L0X_Error VL53L0X_init(VL53L0X_Dev_t *device);
+VL53L0X_Error VL53L0X_configAccuracy(VL53L0X_Dev_t *device, VL53L0X_AccuracyMode accuracy);
+VL53L0X_Error VL53L0X_startMeasure(VL53L0X_Dev_t *device, VL53L0X_DeviceModes mode);
+VL53L0X_Error VL53L0X_getLastMeasure(VL53L0X_Dev_t *device);
+VL53L0X_Error VL53L0X_stopMeasure(VL53L0X_Dev_t *device);
+
+#endif /* VL53L0X_H */
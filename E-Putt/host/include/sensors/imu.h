@@ -0,0 +1,27 @@
+#ifndef IMU_H
+#define IMU_H
+
+#include <stdint.h>
+
+#define X_AXIS		0
+#define Y_AXIS		1
+#define Z_AXIS		2
+#define NB_AXIS		3
+
+typedef struct {
+	float acceleration[NB_AXIS];	//[m/s^2]
+	float gyro_rate[NB_AXIS];		//[rad/s]
+	float temperature;
+	int16_t acc_raw[NB_AXIS];
+	int16_t gyro_raw[NB_AXIS];
+	int16_t acc_offset[NB_AXIS];
+	int16_t gyro_offset[NB_AXIS];
+	uint8_t status;
+} imu_msg_t;
+
+//advertises "/imu", published at the sampling rate of the IMU
+void imu_start(void);
+void calibrate_gyro(void);
+float get_gyro_rate(uint8_t axis);
+
+#endif /* IMU_H */
@@ -0,0 +1,20 @@
+#ifndef PROXIMITY_H
+#define PROXIMITY_H
+
+#define PROXIMITY_NB_CHANNELS	8
+
+typedef struct {
+	unsigned int ambient[PROXIMITY_NB_CHANNELS];
+	unsigned int reflected[PROXIMITY_NB_CHANNELS];
+	unsigned int delta[PROXIMITY_NB_CHANNELS];
+	unsigned int initValue[PROXIMITY_NB_CHANNELS];
+} proximity_msg_t;
+
+//advertises "/proximity", published at the sampling rate of the sensors
+void proximity_start(void);
+void calibrate_ir(void);
+int get_prox(unsigned int sensor_number);
+int get_calibrated_prox(unsigned int sensor_number);
+int get_ambient_light(unsigned int sensor_number);
+
+#endif /* PROXIMITY_H */
@@ -0,0 +1,588 @@
+/*
+ * Virtual-time kernel behind include/ch.h.
+ * Each firmware thread is a coroutine with its own stack. The highest priority ready
+ * thread runs until it blocks, or until it wakes a higher priority one as the ChibiOS
+ * scheduler would preempt it. When nothing is ready, the clock jumps to the next timer
+ * or timeout, so idle time costs nothing. Timer callbacks run from the scheduler, the
+ * host equivalent of the ISR context.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "kernel.h"
+
+#define SIM_MAX_THREADS		32
+#define SIM_STACK_SIZE		(256*1024) //generous, the firmware sizes are for the Cortex-M4
+
+enum threadState{TH_READY = 0, TH_RUNNING, TH_WAITING, TH_FINISHED};
+
+struct ch_thread {
+	ucontext_t ctx;
+	void *stack;
+	tfunc_t func;
+	void *arg;
+	tprio_t prio;
+	const char *name;
+	enum threadState state;
+	int64_t ready_order;	//FIFO among equal priorities, negative when preempted (runs first)
+	const void *wait_obj;	//object blocked on
+	systime_t deadline;
+	bool timed;
+	bool timed_out;
+	eventmask_t events_pending;
+	eventmask_t events_wanted;
+};
+
+void (*sim_post_hook)(mailbox_t *mbp, msg_t msg) = NULL;
+void (*sim_halt_hook)(const char *reason) = NULL;
+
+static thread_t threads[SIM_MAX_THREADS];
+static int nb_threads = 0;
+static thread_t *current = NULL;	//NULL in the scheduler (ISR context)
+static ucontext_t sched_ctx;
+static systime_t now = 0;
+static virtual_timer_t *timers = NULL;	//armed timers, unsorted
+static int64_t ready_counter = 0, ahead_counter = 0;
+static uint64_t switches = 0;
+static uint32_t shuffle_state = 0;
+static int lock_nesting = 0;
+
+//wrap-around safe comparison of two times
+static bool time_before(systime_t a, systime_t b){
+	return (int32_t)(a - b) < 0;
+}
+
+static void make_ready(thread_t *tp){
+	tp->state = TH_READY;
+	tp->wait_obj = NULL;
+	tp->ready_order = ++ready_counter;
+}
+
+static uint32_t shuffle_next(void){
+	shuffle_state ^= shuffle_state << 13;
+	shuffle_state ^= shuffle_state >> 17;
+	shuffle_state ^= shuffle_state << 5;
+	return shuffle_state;
+}
+
+static thread_t *pick_ready(void){
+
+	thread_t *best = NULL;
+	int ties = 0;
+
+	for(int i = 0 ; i < nb_threads ; i++)
+	{
+		thread_t *tp = &threads[i];
+		if(tp->state != TH_READY)
+			continue;
+		if(best == NULL || tp->prio > best->prio)
+		{
+			best = tp;
+			ties = 1;
+		}
+		else if(tp->prio == best->prio)
+		{
+			//reservoir sampling among the ties when shuffling, oldest first otherwise
+			ties++;
+			if(shuffle_state ? (shuffle_next() % ties) == 0 : tp->ready_order < best->ready_order)
+				best = tp;
+		}
+	}
+	return best;
+}
+
+//back to the scheduler, returns when the scheduler switches to this thread again
+static void reschedule(void){
+	thread_t *self = current;
+	switches++;
+	swapcontext(&self->ctx, &sched_ctx);
+}
+
+//a thread woke a higher priority one: it is preempted, as ChibiOS reschedules in the same call
+static void preempt_check(void){
+
+	thread_t *tp = NULL;
+
+	if(current == NULL || lock_nesting)
+		return;
+	tp = pick_ready();
+	if(tp != NULL && tp->prio > current->prio)
+	{
+		current->state = TH_READY;
+		current->ready_order = --ahead_counter;
+		reschedule();
+	}
+}
+
+/* block(object, timeout)
+ * The current thread waits until someone wakes the object or the timeout elapses.
+ * Returns false on timeout. Callers loop on their condition, wake-ups can be spurious.
+ */
+static bool block(const void *obj, systime_t timeout){
+
+	thread_t *self = current;
+
+	if(timeout == TIME_IMMEDIATE)
+		return false;
+	if(self == NULL)
+		chSysHalt("blocking call outside a thread");
+	if(lock_nesting)
+		chSysHalt("blocking call in a critical section");
+
+	self->state = TH_WAITING;
+	self->wait_obj = obj;
+	self->timed = (timeout != TIME_INFINITE);
+	self->deadline = now + timeout;
+	self->timed_out = false;
+	reschedule();
+	return !self->timed_out;
+}
+
+static void wake_all(const void *obj){
+	for(int i = 0 ; i < nb_threads ; i++)
+		if(threads[i].state == TH_WAITING && threads[i].wait_obj == obj)
+			make_ready(&threads[i]);
+}
+
+//time left before an absolute deadline, for the waits looping on a condition
+static systime_t remaining(systime_t timeout, systime_t deadline){
+	if(timeout == TIME_INFINITE)
+		return TIME_INFINITE;
+	return time_before(now, deadline) ? deadline - now : TIME_IMMEDIATE;
+}
+
+static void thread_entry(int index){
+	thread_t *self = &threads[index];
+
+	self->func(self->arg);
+	self->state = TH_FINISHED;
+	swapcontext(&self->ctx, &sched_ctx); //never resumed
+}
+
+/*===========================================================================*/
+/* Host control                                                              */
+/*===========================================================================*/
+
+void sim_reset(void){
+	for(int i = 0 ; i < nb_threads ; i++)
+		free(threads[i].stack);
+	memset(threads, 0, sizeof(threads));
+	nb_threads = 0;
+	current = NULL;
+	timers = NULL;
+	now = 0;
+	ready_counter = ahead_counter = 0;
+	switches = 0;
+	lock_nesting = 0;
+}
+
+void sim_shuffle(uint32_t seed){
+	shuffle_state = seed;
+}
+
+uint64_t sim_switches(void){
+	return switches;
+}
+
+const char *sim_thread_name(const thread_t *tp){
+	return (tp && tp->name) ? tp->name : "?";
+}
+
+bool sim_thread_finished(const thread_t *tp){
+	return tp->state == TH_FINISHED;
+}
+
+//fires the timers due and times out the waits, in the scheduler context
+static void clock_advance(systime_t to){
+
+	virtual_timer_t *vtp = NULL, **link = NULL;
+	bool fired = true;
+
+	now = to;
+	while(fired)
+	{
+		fired = false;
+		for(link = &timers ; *link != NULL ; link = &(*link)->next)
+		{
+			vtp = *link;
+			if(time_before(now, vtp->deadline))
+				continue;
+			*link = vtp->next;
+			vtp->armed = false;
+			vtp->func(vtp->par);
+			fired = true; //the list may have changed, scan again
+			break;
+		}
+	}
+
+	for(int i = 0 ; i < nb_threads ; i++)
+	{
+		thread_t *tp = &threads[i];
+		if(tp->state == TH_WAITING && tp->timed && !time_before(now, tp->deadline))
+		{
+			tp->timed_out = true;
+			make_ready(tp);
+		}
+	}
+}
+
+bool sim_run_until_done(systime_t end, bool (*done)(void)){
+
+	thread_t *tp = NULL;
+	systime_t next = 0;
+
+	while(1)
+	{
+		tp = pick_ready();
+		if(tp != NULL)
+		{
+			current = tp;
+			tp->state = TH_RUNNING;
+			switches++;
+			swapcontext(&sched_ctx, &tp->ctx);
+			current = NULL;
+			continue;
+		}
+
+		if(done != NULL && done())
+			return true;
+		if(!time_before(now, end))
+			return false;
+
+		//nothing to run: jump to the next timer or timeout
+		next = end;
+		for(virtual_timer_t *vtp = timers ; vtp != NULL ; vtp = vtp->next)
+			if(time_before(vtp->deadline, next))
+				next = vtp->deadline;
+		for(int i = 0 ; i < nb_threads ; i++)
+			if(threads[i].state == TH_WAITING && threads[i].timed && time_before(threads[i].deadline, next))
+				next = threads[i].deadline;
+		clock_advance(time_before(now, next) ? next : now);
+	}
+}
+
+void sim_run_until(systime_t end){
+	sim_run_until_done(end, NULL);
+}
+
+bool sim_wait(const void *obj, systime_t timeout){
+	return block(obj, timeout);
+}
+
+void sim_wake(const void *obj){
+	wake_all(obj);
+	preempt_check();
+}
+
+/*===========================================================================*/
+/* System and threads                                                        */
+/*===========================================================================*/
+
+void chSysInit(void){
+	sim_reset();
+}
+
+void chSysHalt(const char *reason){
+	if(sim_halt_hook)
+		sim_halt_hook(reason);
+	fprintf(stderr, "chSysHalt at %u ms in %s: %s\n", (unsigned)ST2MS(now), sim_thread_name(current), reason);
+	abort();
+}
+
+void chSysLock(void){
+	lock_nesting++;
+}
+
+void chSysUnlock(void){
+	if(lock_nesting <= 0)
+		chSysHalt("unbalanced chSysUnlock");
+	lock_nesting--;
+}
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg){
+
+	thread_t *tp = NULL;
+
+	(void)wsp;
+	(void)size;
+	if(nb_threads >= SIM_MAX_THREADS)
+		chSysHalt("too many threads");
+
+	tp = &threads[nb_threads];
+	memset(tp, 0, sizeof(*tp));
+	tp->stack = malloc(SIM_STACK_SIZE);
+	tp->func = pf;
+	tp->arg = arg;
+	tp->prio = prio;
+	getcontext(&tp->ctx);
+	tp->ctx.uc_stack.ss_sp = tp->stack;
+	tp->ctx.uc_stack.ss_size = SIM_STACK_SIZE;
+	tp->ctx.uc_link = NULL;
+	makecontext(&tp->ctx, (void (*)(void))thread_entry, 1, nb_threads);
+	nb_threads++;
+
+	make_ready(tp);
+	preempt_check();
+	return tp;
+}
+
+thread_t *chThdGetSelfX(void){
+	return current;
+}
+
+tprio_t chThdGetPriorityX(void){
+	return current ? current->prio : HIGHPRIO;
+}
+
+void chRegSetThreadName(const char *name){
+	if(current)
+		current->name = name;
+}
+
+void chThdSleep(systime_t time){
+	static const int sleep_obj = 0; //never woken
+
+	if(time == TIME_IMMEDIATE)
+		return;
+	block(&sleep_obj, time);
+}
+
+void chThdSleepUntil(systime_t time){
+	chThdSleep(time - now);
+}
+
+void chThdSleepUntilWindowed(systime_t prev, systime_t next){
+	//as ChibiOS: only sleeps if the current time is still inside [prev, next)
+	if(now - prev < next - prev)
+		chThdSleep(next - now);
+}
+
+void chThdYield(void){
+	if(current == NULL)
+		return;
+	current->state = TH_READY;
+	current->ready_order = ++ready_counter;
+	reschedule();
+}
+
+systime_t chVTGetSystemTime(void){
+	return now;
+}
+
+/*===========================================================================*/
+/* Virtual timers                                                            */
+/*===========================================================================*/
+
+void chVTObjectInit(virtual_timer_t *vtp){
+	memset(vtp, 0, sizeof(*vtp));
+}
+
+void chVTResetI(virtual_timer_t *vtp){
+	for(virtual_timer_t **link = &timers ; *link != NULL ; link = &(*link)->next)
+	{
+		if(*link == vtp)
+		{
+			*link = vtp->next;
+			break;
+		}
+	}
+	vtp->armed = false;
+}
+
+void chVTSetI(virtual_timer_t *vtp, systime_t delay, vtfunc_t vtfunc, void *par){
+	if(vtp->armed)
+		chVTResetI(vtp);
+	vtp->deadline = now + (delay ? delay : 1);
+	vtp->func = vtfunc;
+	vtp->par = par;
+	vtp->armed = true;
+	vtp->next = timers;
+	timers = vtp;
+}
+
+bool chVTIsArmedI(virtual_timer_t *vtp){
+	return vtp->armed;
+}
+
+/*===========================================================================*/
+/* Events                                                                    */
+/*===========================================================================*/
+
+void chEvtObjectInit(event_source_t *esp){
+	esp->next = NULL;
+}
+
+void chEvtRegisterMask(event_source_t *esp, event_listener_t *elp, eventmask_t events){
+	elp->listener = current;
+	elp->events = events;
+	elp->next = esp->next;
+	esp->next = elp;
+}
+
+void chEvtUnregister(event_source_t *esp, event_listener_t *elp){
+	for(event_listener_t **link = &esp->next ; *link != NULL ; link = &(*link)->next)
+	{
+		if(*link == elp)
+		{
+			*link = elp->next;
+			return;
+		}
+	}
+}
+
+static void signal_thread(thread_t *tp, eventmask_t events){
+	tp->events_pending |= events;
+	if(tp->state == TH_WAITING && tp->wait_obj == &tp->events_pending
+		&& (tp->events_pending & tp->events_wanted))
+		make_ready(tp);
+}
+
+void chEvtBroadcastI(event_source_t *esp){
+	for(event_listener_t *elp = esp->next ; elp != NULL ; elp = elp->next)
+		signal_thread(elp->listener, elp->events);
+}
+
+void chEvtBroadcast(event_source_t *esp){
+	chEvtBroadcastI(esp);
+	preempt_check();
+}
+
+void chEvtSignal(thread_t *tp, eventmask_t events){
+	signal_thread(tp, events);
+	preempt_check();
+}
+
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t time){
+
+	thread_t *self = current;
+	eventmask_t served = self->events_pending & events;
+
+	if(served == 0)
+	{
+		self->events_wanted = events;
+		if(!block(&self->events_pending, time))
+			return 0;
+		served = self->events_pending & events;
+	}
+	self->events_pending &= ~served;
+	return served;
+}
+
+/*===========================================================================*/
+/* Mailboxes                                                                 */
+/*===========================================================================*/
+
+void chMBObjectInit(mailbox_t *mbp, msg_t *buf, cnt_t n){
+	mbp->buffer = buf;
+	mbp->size = n;
+	mbp->rd = mbp->cnt = 0;
+}
+
+void chMBReset(mailbox_t *mbp){
+	mbp->rd = mbp->cnt = 0;
+	wake_all(mbp);
+}
+
+msg_t chMBPostI(mailbox_t *mbp, msg_t msg){
+	if(mbp->cnt >= mbp->size)
+		return MSG_TIMEOUT;
+	mbp->buffer[(mbp->rd + mbp->cnt) % mbp->size] = msg;
+	mbp->cnt++;
+	wake_all(mbp);
+	return MSG_OK;
+}
+
+msg_t chMBPost(mailbox_t *mbp, msg_t msg, systime_t timeout){
+
+	systime_t deadline = now + timeout;
+
+	if(sim_post_hook)
+		sim_post_hook(mbp, msg);
+	while(chMBPostI(mbp, msg) != MSG_OK)
+		if(!block(mbp, remaining(timeout, deadline)))
+			return MSG_TIMEOUT;
+	preempt_check();
+	return MSG_OK;
+}
+
+msg_t chMBFetchI(mailbox_t *mbp, msg_t *msgp){
+	if(mbp->cnt == 0)
+		return MSG_TIMEOUT;
+	*msgp = mbp->buffer[mbp->rd];
+	mbp->rd = (mbp->rd + 1) % mbp->size;
+	mbp->cnt--;
+	wake_all(mbp);
+	return MSG_OK;
+}
+
+msg_t chMBFetch(mailbox_t *mbp, msg_t *msgp, systime_t timeout){
+
+	systime_t deadline = now + timeout;
+
+	while(chMBFetchI(mbp, msgp) != MSG_OK)
+		if(!block(mbp, remaining(timeout, deadline)))
+			return MSG_TIMEOUT;
+	preempt_check();
+	return MSG_OK;
+}
+
+cnt_t chMBGetUsedCountI(mailbox_t *mbp){
+	return mbp->cnt;
+}
+
+cnt_t chMBGetFreeCountI(mailbox_t *mbp){
+	return mbp->size - mbp->cnt;
+}
+
+/*===========================================================================*/
+/* Semaphores                                                                */
+/*===========================================================================*/
+
+void chSemObjectInit(semaphore_t *sp, cnt_t n){
+	sp->cnt = n;
+}
+
+msg_t chSemWaitTimeout(semaphore_t *sp, systime_t time){
+
+	systime_t deadline = now + time;
+
+	while(sp->cnt <= 0)
+		if(!block(sp, remaining(time, deadline)))
+			return MSG_TIMEOUT;
+	sp->cnt--;
+	return MSG_OK;
+}
+
+void chSemSignalI(semaphore_t *sp){
+	sp->cnt++;
+	wake_all(sp);
+}
+
+void chSemSignal(semaphore_t *sp){
+	chSemSignalI(sp);
+	preempt_check();
+}
+
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken){
+	bsp->sem.cnt = taken ? 0 : 1;
+}
+
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t time){
+	return chSemWaitTimeout(&bsp->sem, time);
+}
+
+void chBSemSignalI(binary_semaphore_t *bsp){
+	if(bsp->sem.cnt < 1)
+		chSemSignalI(&bsp->sem);
+}
+
+void chBSemSignal(binary_semaphore_t *bsp){
+	chBSemSignalI(bsp);
+	preempt_check();
+}
+
+void chBSemReset(binary_semaphore_t *bsp, bool taken){
+	bsp->sem.cnt = taken ? 0 : 1;
+	wake_all(&bsp->sem);
+}
@@ -0,0 +1,39 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "ch.h"
+
+//Host side of the kernel shim: the test or the simulator owns the virtual clock.
+//The firmware threads only run inside sim_run_until(), from the main host thread.
+
+//forgets every thread, timer and listener and puts the clock back to 0 (also done by chSysInit)
+void sim_reset(void);
+//runs the ready threads, firing the timers in order, until the virtual clock reaches end
+void sim_run_until(systime_t end);
+//same, stops as soon as done() returns true, checked whenever the clock advances
+//returns true if it stopped on done()
+bool sim_run_until_done(systime_t end, bool (*done)(void));
+
+//ready threads of equal priority are taken in FIFO order, or in a random order from
+//this seed (0 back to FIFO) to shake the interleavings in stress tests
+void sim_shuffle(uint32_t seed);
+
+//test seam, called by chMBPost before posting: a test can sleep in it to open a race window
+extern void (*sim_post_hook)(mailbox_t *mbp, msg_t msg);
+//called instead of aborting when the firmware halts, e.g. to longjmp out of a test
+extern void (*sim_halt_hook)(const char *reason);
+
+//for the host libraries and devices: the current thread waits until the object is woken,
+//false on timeout. Wake-ups can be spurious, loop on the condition.
+bool sim_wait(const void *obj, systime_t timeout);
+//readies every thread waiting on the object, from a thread or a timer
+void sim_wake(const void *obj);
+
+//context switches since the reset
+uint64_t sim_switches(void);
+//name given by chRegSetThreadName, "?" before
+const char *sim_thread_name(const thread_t *tp);
+//true when the thread returned from its function
+bool sim_thread_finished(const thread_t *tp);
+
+#endif /* KERNEL_H */
@@ -0,0 +1,70 @@
+/*
+ * Calibration of the host against the Cortex-M4 of the robot. The reference loop counts the
+ * bytes under a threshold; built by arm-none-eabi-gcc -O2 it is
+ *	ldrb r3, [r0], #1	2 cycles
+ *	cmp r3, r2			1
+ *	it cc / addcc r1, #1	1
+ *	cmp r0, ip			1
+ *	bne loop			1 + 2 of pipeline refill
+ * that is CALIB_M4_CYCLES cycles per byte running from the flash accelerator. Timed the same
+ * way on the host, the fastest of a few batches, it gives M4 cycles per host nanosecond.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "m4_calib.h"
+#include "render.h"
+
+#define CALIB_BYTES			640
+#define CALIB_BATCH			200
+#define CALIB_REPEAT			100
+#define CALIB_M4_CYCLES		8 //per byte, see above
+#define CALIB_WARMUP_NS		200000000 //the host clock speeds up under load, timed after it
+
+static uint32_t host_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec*1000000000ULL + ts.tv_nsec);
+}
+
+//the host would otherwise run it 16 or 32 bytes at a time, which the M4 can't
+__attribute__((noinline, optimize("no-tree-vectorize")))
+static uint16_t reference_scan(const volatile uint8_t *buffer, uint16_t n, uint8_t threshold){
+
+	uint16_t count = 0;
+
+	for(uint16_t i = 0 ; i < n ; i++)
+		if(buffer[i] < threshold)
+			count++;
+	return count;
+}
+
+float m4_cycles_per_ns(void){
+
+	static bool warm = false;
+	static uint8_t buffer[CALIB_BYTES];
+	uint32_t best = UINT32_MAX, start = 0, t = 0;
+	volatile uint16_t sink = 0;
+
+	//bright table, the branch is always taken the same way as in most of a real line
+	if(!warm)
+	{
+		for(uint16_t i = 0 ; i < CALIB_BYTES ; i++)
+			buffer[i] = rng_uniform(150, 255);
+		start = host_ns();
+		while(host_ns() - start < CALIB_WARMUP_NS)
+			sink += reference_scan(buffer, CALIB_BYTES, 128);
+		warm = true;
+	}
+	for(uint8_t r = 0 ; r < CALIB_REPEAT ; r++)
+	{
+		start = host_ns();
+		for(uint16_t b = 0 ; b < CALIB_BATCH ; b++)
+			sink += reference_scan(buffer, CALIB_BYTES, 128);
+		t = host_ns() - start;
+		if(t < best)
+			best = t;
+	}
+	return (float)CALIB_M4_CYCLES*CALIB_BYTES*CALIB_BATCH/best;
+}
@@ -0,0 +1,12 @@
+#ifndef M4_CALIB_H
+#define M4_CALIB_H
+
+//Cortex-M4 cycles per nanosecond of this host, from a reference loop timed here and counted
+//in instructions on the robot. Scales host timings of byte scans (a load, a compare and a
+//branch per byte, as in reduce_band() and extract_ball_pos()) to cycles of the robot: a rough
+//estimate, not a cycle-exact model. The host predicts branches and the M4 doesn't.
+//The speed of the host drifts over seconds: each call times the loop again, next to the
+//timings it scales.
+float m4_cycles_per_ns(void);
+
+#endif /* M4_CALIB_H */
@@ -0,0 +1,73 @@
+/*
+ * Message bus of the e-puck2 library on the kernel shim: topics are found by name,
+ * a wait returns the next publication. Publishing is allowed from the timers (ISR context),
+ * the sensor models publish from there.
+ */
+#include <string.h>
+
+#include "kernel.h"
+#include "msgbus/messagebus.h"
+
+void messagebus_init(messagebus_t *bus, void *lock, void *condvar){
+	(void)lock;
+	(void)condvar;
+	bus->topics = NULL;
+}
+
+void messagebus_topic_init(messagebus_topic_t *topic, void *topic_lock, void *topic_condvar,
+						   void *buffer, size_t buffer_len){
+	(void)topic_lock;
+	(void)topic_condvar;
+	memset(topic, 0, sizeof(*topic));
+	topic->buffer = buffer;
+	topic->buffer_len = buffer_len;
+}
+
+void messagebus_advertise_topic(messagebus_t *bus, messagebus_topic_t *topic, const char *name){
+	strncpy(topic->name, name, TOPIC_NAME_MAX_LENGTH);
+	topic->next = bus->topics;
+	bus->topics = topic;
+	sim_wake(bus);
+}
+
+messagebus_topic_t *messagebus_find_topic(messagebus_t *bus, const char *name){
+	for(messagebus_topic_t *topic = bus->topics ; topic != NULL ; topic = topic->next)
+		if(strcmp(topic->name, name) == 0)
+			return topic;
+	return NULL;
+}
+
+messagebus_topic_t *messagebus_find_topic_blocking(messagebus_t *bus, const char *name){
+
+	messagebus_topic_t *topic = NULL;
+
+	while((topic = messagebus_find_topic(bus, name)) == NULL)
+		sim_wait(bus, TIME_INFINITE);
+	return topic;
+}
+
+bool messagebus_topic_publish(messagebus_topic_t *topic, const void *buf, size_t buf_len){
+	if(buf_len > topic->buffer_len)
+		return false;
+	memcpy(topic->buffer, buf, buf_len);
+	topic->published = true;
+	topic->seq++;
+	sim_wake(topic);
+	return true;
+}
+
+bool messagebus_topic_read(messagebus_topic_t *topic, void *buf, size_t buf_len){
+	if(!topic->published)
+		return false;
+	memcpy(buf, topic->buffer, buf_len < topic->buffer_len ? buf_len : topic->buffer_len);
+	return true;
+}
+
+void messagebus_topic_wait(messagebus_topic_t *topic, void *buf, size_t buf_len){
+
+	uint32_t seq = topic->seq;
+
+	while(topic->seq == seq)
+		sim_wait(topic, TIME_INFINITE);
+	messagebus_topic_read(topic, buf, buf_len);
+}
@@ -0,0 +1,215 @@
+/*
+ * Plant of the closed-loop simulator, behind the devices of hw.c: differential drive moved by
+ * the wheel speeds the firmware writes, a ball pushed by the putter and rolling to a stop, the
+ * camera band rendered from the bearing and the distance of the ball and of the goal marker,
+ * the VL53L0X, the front IR sensors and the gyro.
+ */
+#include <math.h>
+
+#include "plant.h"
+#include "render.h"
+
+#include <main.h>
+#include <motors.h>
+
+#define ROLLING_DECEL		150 //[mm/s2] ball on the table
+#define ROBOT_MASS_G			150
+#define BALL_MASS_G			46
+#define RESTITUTION			0.5f
+#define TOF_HALF_FOV			0.22f //[rad] of the VL53L0X cone
+#define PROX_TOUCH			3000 //reading of a sensor facing the ball at contact
+#define PROX_DECAY_MM		10
+#define PROX_HALF_FOV		0.6f //[rad]
+
+//directions of the IR sensors, from IR0 front right clockwise back to IR7 front left
+static const float prox_angle[8] = {-0.30f, -0.86f, -1.57f, -2.62f, 2.62f, 1.57f, 0.86f, 0.30f};
+
+static plant_config_t cfg;
+static plant_state_t st;
+static float ball_vx = 0, ball_vy = 0, omega = 0;
+static float contact_x = 0, contact_y = 0;
+static float left_ground = 0, right_ground = 0; //[mm/s] of the wheels on the table
+
+//v = (x, y) in the robot frame: x ahead, y on the left
+static void to_robot(float dx, float dy, float *x, float *y){
+	*x = dx*cosf(st.heading) + dy*sinf(st.heading);
+	*y = -dx*sinf(st.heading) + dy*cosf(st.heading);
+}
+
+/* push_ball(speed)
+ * The putter pushes the ball straight ahead of the robot, whatever the point of contact.
+ * A ball beside the putter isn't touched.
+ */
+static void push_ball(float speed){
+
+	float ahead = 0, lateral = 0, closing = 0, impulse = 0;
+
+	to_robot(st.ball_x - st.x, st.ball_y - st.y, &ahead, &lateral);
+	ahead -= PLANT_ROBOT_RADIUS_MM + PLANT_PUTTER_MM + PLANT_BALL_RADIUS_MM;
+	if(ahead >= 0 || ahead < -PLANT_BALL_RADIUS_MM || fabsf(lateral) > PLANT_PUTTER_WIDTH_MM/2)
+		return;
+
+	closing = speed - ball_vx*cosf(st.heading) - ball_vy*sinf(st.heading);
+	if(closing > 0)
+	{
+		impulse = (1 + RESTITUTION)*ROBOT_MASS_G/(ROBOT_MASS_G + BALL_MASS_G)*closing;
+		ball_vx += impulse*cosf(st.heading);
+		ball_vy += impulse*sinf(st.heading);
+	}
+	if(!st.contact)
+	{
+		st.contact = true;
+		st.lateral_mm = fabsf(lateral);
+		st.contact_heading = st.heading;
+		contact_x = st.ball_x;
+		contact_y = st.ball_y;
+	}
+	st.ball_x -= ahead*cosf(st.heading);
+	st.ball_y -= ahead*sinf(st.heading);
+}
+
+//speed of a wheel on the table toward the one of its steps, slipping above its grip
+static float grip(float ground, float wheel, float traction, float dt){
+	if(traction <= 0 || fabsf(wheel - ground) <= traction*dt)
+		return wheel;
+	return ground + (wheel > ground ? traction*dt : -traction*dt);
+}
+
+static void step(float dt){
+
+	float left = 0, right = 0, speed = 0, decel = ROLLING_DECEL*dt;
+
+	left_ground = grip(left_ground, STEPS_TO_MM((float)hw_left_speed())*(1 + cfg.wheel_bias),
+					   cfg.traction*(1 + cfg.traction_bias), dt);
+	right_ground = grip(right_ground, STEPS_TO_MM((float)hw_right_speed())*(1 - cfg.wheel_bias),
+						cfg.traction*(1 - cfg.traction_bias), dt);
+	left = left_ground;
+	right = right_ground;
+	speed = (left + right)/2;
+
+	omega = (right - left)/WHEEL_DISTANCE_MM;
+	st.x += speed*cosf(st.heading)*dt;
+	st.y += speed*sinf(st.heading)*dt;
+	st.heading += omega*dt;
+
+	st.ball_x += ball_vx*dt;
+	st.ball_y += ball_vy*dt;
+	st.ball_speed = hypotf(ball_vx, ball_vy);
+	if(st.ball_speed > st.launch_speed)
+		st.launch_speed = st.ball_speed;
+	if(st.ball_speed > decel)
+	{
+		ball_vx -= decel*ball_vx/st.ball_speed;
+		ball_vy -= decel*ball_vy/st.ball_speed;
+	}
+	else
+		ball_vx = ball_vy = 0;
+	push_ball(speed);
+}
+
+/* project(x, y, radius, width, left, right)
+ * Columns covered by a round object seen from the camera, at the front of the robot.
+ * Returns false behind the camera.
+ */
+static bool project(float x, float y, float radius, uint16_t width, float *left, float *right){
+
+	float ahead = 0, lateral = 0, center = 0, half = 0;
+	float scale = (float)width/IMAGE_BUFFER_SIZE;
+
+	to_robot(x - st.x, y - st.y, &ahead, &lateral);
+	ahead -= PLANT_ROBOT_RADIUS_MM;
+	if(ahead <= radius)
+		return false;
+	//a ball on the left is on the left of the image
+	center = width/2 - scale*FOCAL_PXL*lateral/ahead;
+	half = scale*FOCAL_PXL*radius/hypotf(ahead, lateral);
+	*left = center - half;
+	*right = center + half;
+	return true;
+}
+
+static void render(uint8_t *band, uint16_t width, uint16_t lines, bool yuv){
+
+	scene_t scene = {.ball_lines = lines, .light = cfg.light, .noise = cfg.noise};
+
+	project(st.ball_x, st.ball_y, PLANT_BALL_RADIUS_MM, width, &scene.ball_left, &scene.ball_right);
+	if(cfg.goal_radius > 0)
+		project(cfg.goal_x, cfg.goal_y, PLANT_GOAL_WIDTH_MM/2, width, &scene.goal_left, &scene.goal_right);
+	render_band(band, width, lines, yuv, &scene);
+}
+
+static bool frame_lost(void){
+	return rng_uniform(0, 1) < cfg.frame_loss;
+}
+
+static uint16_t tof_mm(void){
+
+	float ahead = 0, lateral = 0, dist = 0;
+
+	to_robot(st.ball_x - st.x, st.ball_y - st.y, &ahead, &lateral);
+	ahead -= PLANT_ROBOT_RADIUS_MM;
+	dist = hypotf(ahead, lateral);
+	if(ahead <= 0 || fabsf(atan2f(lateral, ahead)) > TOF_HALF_FOV + asinf(fminf(1, PLANT_BALL_RADIUS_MM/dist)))
+		return HW_TOF_NO_TARGET;
+	dist += rng_gauss(cfg.tof_noise) - PLANT_BALL_RADIUS_MM;
+	return dist > 0 ? dist : 0;
+}
+
+static int prox(uint8_t sensor){
+
+	float ahead = 0, lateral = 0, off = 0, gap = 0;
+
+	//the putter is in the way: the sensors see the ball as if on their side of it
+	to_robot(st.ball_x - st.x, st.ball_y - st.y, &ahead, &lateral);
+	ahead -= PLANT_PUTTER_MM;
+	off = fabsf(remainderf(atan2f(lateral, ahead) - prox_angle[sensor], 2*M_PI));
+	gap = hypotf(ahead, lateral) - PLANT_ROBOT_RADIUS_MM - PLANT_BALL_RADIUS_MM;
+	if(off > PROX_HALF_FOV)
+		return 0;
+	return PROX_TOUCH*expf(-fmaxf(gap, 0)/PROX_DECAY_MM)*cosf(off);
+}
+
+static float gyro_z(void){
+	return omega + cfg.gyro_bias + rng_gauss(cfg.gyro_noise);
+}
+
+static const hw_backend_t backend = {
+	.step = step,
+	.render = render,
+	.frame_lost = frame_lost,
+	.tof_mm = tof_mm,
+	.prox = prox,
+	.gyro_z = gyro_z,
+};
+
+const hw_backend_t *plant_init(const plant_config_t *config){
+
+	cfg = *config;
+	st = (plant_state_t){.heading = cfg.heading, .ball_x = cfg.ball_x, .ball_y = cfg.ball_y};
+	ball_vx = ball_vy = omega = 0;
+	left_ground = right_ground = 0;
+	return &backend;
+}
+
+/* plant_state()
+ * The line of the shot goes from the ball at the contact through where it is now. The ball
+ * can't roll as far as the goal marker, scoring is judged on the direction only.
+ */
+plant_state_t plant_state(void){
+
+	float dx = st.ball_x - contact_x, dy = st.ball_y - contact_y, moved = hypotf(dx, dy);
+	float gx = cfg.goal_x - contact_x, gy = cfg.goal_y - contact_y;
+
+	st.goal_miss_mm = INFINITY;
+	if(st.contact && moved > 0 && gx*dx + gy*dy > 0)
+		st.goal_miss_mm = fabsf(gx*dy - gy*dx)/moved;
+	return st;
+}
+
+void plant_move_ball(float angle){
+
+	float dx = st.ball_x - st.x, dy = st.ball_y - st.y;
+
+	st.ball_x = st.x + dx*cosf(angle) - dy*sinf(angle);
+	st.ball_y = st.y + dx*sinf(angle) + dy*cosf(angle);
+}
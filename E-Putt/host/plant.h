@@ -0,0 +1,56 @@
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdbool.h>
+
+#include "hw.h"
+
+//Field of the closed-loop simulator: the robot on a table with the ball and the goal marker.
+//Positions in mm, the robot starts at the origin, angles in rad counterclockwise from +x.
+#define PLANT_ROBOT_RADIUS_MM	37
+#define PLANT_BALL_RADIUS_MM		20
+#define PLANT_GOAL_WIDTH_MM		30 //yellow marker seen by the camera
+//The putter is ahead of the front of the robot, where the camera and the sensors are: the TOF
+//reads this distance when the ball touches it (CONTACT_DIST_MM of eputt_regulator.c)
+#define PLANT_PUTTER_MM			40
+#define PLANT_PUTTER_WIDTH_MM	50
+
+typedef struct {
+	float ball_x;
+	float ball_y;
+	float goal_x;			//marker of the goal, none if goal_radius is 0
+	float goal_y;
+	float goal_radius;		//[mm] scored if the shot is aimed this close to the marker
+	float heading;			//of the robot at start
+	float wheel_bias;		//the left wheel travels (1 + bias) of its steps, the right one (1 - bias)
+	float traction;			//[mm/s2] the wheels slip above this acceleration, never for 0...
+	float traction_bias;	//...the left one grips (1 + bias) of it, the right one (1 - bias)
+	float gyro_bias;		//[rad/s] left after the calibration
+	float gyro_noise;		//[rad/s]
+	float tof_noise;		//[mm]
+	float light;			//camera brightness, 1 for a well exposed frame
+	float noise;			//camera pixel noise, in 8 bits levels
+	float frame_loss;		//probability of a capture never completing
+} plant_config_t;
+
+typedef struct {
+	float x;
+	float y;
+	float heading;
+	float ball_x;
+	float ball_y;
+	float ball_speed;		//[mm/s]
+	bool contact;			//the robot touched the ball
+	float lateral_mm;		//at the first contact: ball center to the middle of the putter
+	float contact_heading;	//of the robot at the first contact
+	float launch_speed;		//[mm/s] fastest the ball went once touched
+	float goal_miss_mm;		//closest the line of the shot passes to the goal marker
+} plant_state_t;
+
+//places the robot and the ball, the backend to give to hw_init()
+const hw_backend_t *plant_init(const plant_config_t *cfg);
+plant_state_t plant_state(void);
+//moves the ball around the robot by the given angle, at the same distance
+void plant_move_ball(float angle);
+
+#endif /* PLANT_H */
@@ -0,0 +1,114 @@
+/*
+ * Synthetic line camera: renders the band of the PO8030 in RGB565 or YCbYCr from a scene.
+ * Partially covered columns are blended, so sub-pixel motion shows in the profile.
+ */
+#include <math.h>
+
+#include "render.h"
+
+typedef struct {
+	float r;
+	float g;
+	float b;
+} color_t;
+
+static const color_t table_color = {235, 235, 228};
+static const color_t ball_color = {190, 40, 45};
+static const color_t goal_color = {230, 205, 40};
+
+static uint32_t rng_state = 1;
+
+void rng_seed(uint32_t seed){
+	rng_state = seed ? seed : 1;
+}
+
+uint32_t rng_next(void){
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+float rng_uniform(float min, float max){
+	return min + (max - min)*(rng_next() >> 8)/(float)(1 << 24);
+}
+
+float rng_gauss(float sigma){
+	float u1 = rng_uniform(1e-7f, 1), u2 = rng_uniform(0, 1);
+	return sigma*sqrtf(-2*logf(u1))*cosf(2*(float)M_PI*u2);
+}
+
+//part of the pixel [i, i+1) covered by [left, right)
+static float coverage(uint16_t i, float left, float right){
+	float from = (left > i) ? left : i, to = (right < i + 1) ? right : i + 1;
+	return (to > from) ? to - from : 0;
+}
+
+static float channel(float value, float light, float noise){
+	value = value*light + rng_gauss(noise);
+	return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+static color_t pixel_color(const scene_t *scene, uint16_t line, uint16_t lines, uint16_t i){
+
+	color_t c = table_color;
+	float k = coverage(i, scene->goal_left, scene->goal_right);
+	uint16_t first = scene->ball_low ? lines - scene->ball_lines : (lines - scene->ball_lines)/2;
+
+	c.r += k*(goal_color.r - c.r);
+	c.g += k*(goal_color.g - c.g);
+	c.b += k*(goal_color.b - c.b);
+
+	//the ball is in front of the goal marker
+	if(line >= first && line < first + scene->ball_lines)
+	{
+		k = coverage(i, scene->ball_left, scene->ball_right);
+		c.r += k*(ball_color.r - c.r);
+		c.g += k*(ball_color.g - c.g);
+		c.b += k*(ball_color.b - c.b);
+	}
+
+	c.r = channel(c.r, scene->light, scene->noise);
+	c.g = channel(c.g, scene->light, scene->noise);
+	c.b = channel(c.b, scene->light, scene->noise);
+	return c;
+}
+
+void render_band(uint8_t *band, uint16_t width, uint16_t lines, bool yuv, const scene_t *scene){
+
+	color_t c[2];
+	float y[2], cb = 0, cr = 0;
+	uint16_t rgb = 0;
+	uint8_t *out = band;
+
+	for(uint16_t line = 0 ; line < lines ; line++)
+	{
+		for(uint16_t i = 0 ; i < width ; i += 2)
+		{
+			c[0] = pixel_color(scene, line, lines, i);
+			c[1] = pixel_color(scene, line, lines, i + 1);
+			if(yuv)
+			{
+				//BT.601, one Cb and one Cr shared by the two pixels
+				for(uint8_t k = 0 ; k < 2 ; k++)
+					y[k] = 0.299f*c[k].r + 0.587f*c[k].g + 0.114f*c[k].b;
+				cb = 128 + (-0.169f*(c[0].r + c[1].r) - 0.331f*(c[0].g + c[1].g) + 0.5f*(c[0].b + c[1].b))/2;
+				cr = 128 + (0.5f*(c[0].r + c[1].r) - 0.419f*(c[0].g + c[1].g) - 0.081f*(c[0].b + c[1].b))/2;
+				*out++ = (uint8_t)y[0];
+				*out++ = (uint8_t)cb;
+				*out++ = (uint8_t)y[1];
+				*out++ = (uint8_t)cr;
+			}
+			else
+			{
+				//RGB565, most significant byte first as the DCMI stores it
+				for(uint8_t k = 0 ; k < 2 ; k++)
+				{
+					rgb = (((uint16_t)c[k].r >> 3) << 11) | (((uint16_t)c[k].g >> 2) << 5) | ((uint16_t)c[k].b >> 3);
+					*out++ = rgb >> 8;
+					*out++ = rgb & 0xFF;
+				}
+			}
+		}
+	}
+}
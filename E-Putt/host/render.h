@@ -0,0 +1,28 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//What the captured band sees, in columns of the image
+typedef struct {
+	float ball_left;	//columns covered by the ball, none if ball_right <= ball_left
+	float ball_right;
+	uint8_t ball_lines;	//lines of the band covered by the ball, centered...
+	bool ball_low;		//...or the last ones, the band crossing the top of the ball
+	float goal_left;	//yellow goal marker, none if goal_right <= goal_left
+	float goal_right;
+	float light;		//brightness relative to a well exposed frame
+	float noise;		//standard deviation of the pixel noise, in 8 bits levels
+} scene_t;
+
+//white table, red ball, yellow goal marker, as the PO8030 delivers them
+void render_band(uint8_t *band, uint16_t width, uint16_t lines, bool yuv, const scene_t *scene);
+
+//random numbers of the host tools, one stream per process
+void rng_seed(uint32_t seed);
+uint32_t rng_next(void);
+float rng_uniform(float min, float max);
+float rng_gauss(float sigma);
+
+#endif /* RENDER_H */
@@ -0,0 +1,513 @@
+/*
+ * Closed-loop simulator of the E-Putt: the firmware threads of main.c, without the microphones,
+ * run on the virtual clock against the plant of plant.c. An operator whistles the tones, a
+ * scenario file places the ball and the goal and sets the disturbances, and its runs are drawn
+ * at random around it, each in its own process, as many at a time as there are cores.
+ *	sim [-j jobs] [-n runs] [-s seed] [-t trace.csv] scenario...
+ * With -t, a single run writes the regulator trace (built with REGULATOR_TRACE).
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "plant.h"
+#include "render.h"
+
+#include <motors.h>
+#include <camera/po8030.h>
+
+#include <main.h>
+#include <process_image.h>
+#include <eputt_regulator.h>
+#include <motion_profile.h>
+#include <motor_arbiter.h>
+#include <tof.h>
+#include <ir_proximity.h>
+#include <odometry.h>
+#include <led_sequencer.h>
+#include <state_machine.h>
+
+#define RUNS_DEFAULT			100
+#define TIMEOUT_DEFAULT_MS	30000
+#define OPERATOR_DEFAULT_MS	500 //from the state change to the tone
+#define SETTLE_MS			5000 //at most, for the ball to stop after the shot
+#define STATS_PERIOD_MS		1000 //as STATS_WINDOW_MS of eputt_regulator.c
+#define MAX_RUNS				10000
+#ifndef SIM_VARIANT
+#define SIM_VARIANT			"defaults" //of the firmware, or the UDEFS of the Makefile variant
+#endif
+
+typedef struct {
+	char name[64];
+	uint16_t runs;
+	uint32_t timeout_ms;
+	uint16_t operator_ms;
+	uint8_t tones;			//given from MANUAL_MOVE, the one from STARTUP is always given
+	plant_config_t plant;
+	float ball_jitter;		//[mm] around the ball position
+	float heading_jitter;	//[rad]
+	float bias_jitter;		//around wheel_bias
+	uint32_t kick_ms;		//after the ball is first seen, it is moved around the robot...
+	float kick_angle;		//...by this angle [rad], 0 for never...
+	uint32_t kick_slide_ms;	//...sliding it at a constant rate over this time, at once for 0
+} scenario_t;
+
+typedef struct {
+	bool locked;			//BALL_LOCKED reached
+	bool shot;				//SHOT_VERIFY reached
+	bool confirmed;			//the camera confirmed the shot
+	bool scored;			//the shot was aimed close enough to the goal marker
+	bool contact;
+	bool kicked;
+	bool reacquired;
+	uint32_t lock_ms;		//from the first search
+	uint32_t shot_ms;		//from the first search to the end of the last charge
+	uint32_t reacquire_ms;	//from the kick to the ball seen again
+	uint32_t cycle_ms;		//shot_cycle_stats_t, when confirmed
+	uint32_t sim_ms;
+	float lateral_mm;		//at the contact
+	float launch_speed;		//[mm/s] of the ball
+	float drift;			//[rad] turn of the robot from the start of the charge to the contact
+	float wakeups;			//of the regulator, per second
+	float motor_wakeups;	//of the motor thread, per second
+	uint16_t latency_max;	//[ms] from the end of a frame to the wheels
+} result_t;
+
+static const char *trace = NULL;
+
+/* parse(file, scenario)
+ * One setting per line, "key values", # starts a comment.
+ */
+static bool parse(const char *path, scenario_t *sc){
+
+	FILE *f = fopen(path, "r");
+	char line[256], key[32];
+	const char *base = strrchr(path, '/');
+	float a = 0, b = 0, c = 0;
+	int n = 0;
+	bool ok = true;
+
+	if(!f)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return false;
+	}
+	memset(sc, 0, sizeof(*sc));
+	snprintf(sc->name, sizeof(sc->name), "%s", base ? base + 1 : path);
+	if(strrchr(sc->name, '.'))
+		*strrchr(sc->name, '.') = '\0';
+	sc->runs = RUNS_DEFAULT;
+	sc->timeout_ms = TIMEOUT_DEFAULT_MS;
+	sc->operator_ms = OPERATOR_DEFAULT_MS;
+	sc->tones = 1;
+	sc->plant.light = 1;
+
+	while(ok && fgets(line, sizeof(line), f))
+	{
+		if(strchr(line, '#'))
+			*strchr(line, '#') = '\0';
+		n = sscanf(line, "%31s %f %f %f", key, &a, &b, &c);
+		if(n <= 0)
+			continue;
+		if(!strcmp(key, "runs") && n == 2)
+			sc->runs = a;
+		else if(!strcmp(key, "timeout_ms") && n == 2)
+			sc->timeout_ms = a;
+		else if(!strcmp(key, "operator_ms") && n == 2)
+			sc->operator_ms = a;
+		else if(!strcmp(key, "tones") && n == 2)
+			sc->tones = a;
+		else if(!strcmp(key, "ball") && n == 3)
+		{
+			sc->plant.ball_x = a;
+			sc->plant.ball_y = b;
+		}
+		else if(!strcmp(key, "goal") && n == 4)
+		{
+			sc->plant.goal_x = a;
+			sc->plant.goal_y = b;
+			sc->plant.goal_radius = c;
+		}
+		else if(!strcmp(key, "heading") && n == 2)
+			sc->plant.heading = a;
+		else if(!strcmp(key, "wheel_bias") && n == 2)
+			sc->plant.wheel_bias = a;
+		else if(!strcmp(key, "traction") && n == 3)
+		{
+			sc->plant.traction = a;
+			sc->plant.traction_bias = b;
+		}
+		else if(!strcmp(key, "gyro") && n == 3)
+		{
+			sc->plant.gyro_bias = a;
+			sc->plant.gyro_noise = b;
+		}
+		else if(!strcmp(key, "tof_noise") && n == 2)
+			sc->plant.tof_noise = a;
+		else if(!strcmp(key, "camera") && n == 3)
+		{
+			sc->plant.light = a;
+			sc->plant.noise = b;
+		}
+		else if(!strcmp(key, "frame_loss") && n == 2)
+			sc->plant.frame_loss = a;
+		else if(!strcmp(key, "jitter") && n == 4)
+		{
+			sc->ball_jitter = a;
+			sc->heading_jitter = b;
+			sc->bias_jitter = c;
+		}
+		else if(!strcmp(key, "kick") && (n == 3 || n == 4))
+		{
+			sc->kick_ms = a;
+			sc->kick_angle = b;
+			sc->kick_slide_ms = n == 4 ? c : 0;
+		}
+		else
+		{
+			fprintf(stderr, "%s: unknown setting %s", path, line);
+			ok = false;
+		}
+	}
+	fclose(f);
+	return ok;
+}
+
+//the threads of main.c, the microphones aside
+static void start_firmware(void){
+	dcmi_start();
+	po8030_start();
+	motors_init();
+	motion_start();
+	led_sequencer_start();
+	state_machine_start();
+	capture_process_img_start();
+	regulator_start();
+	tof_start();
+	ir_proximity_start();
+	odometry_start();
+}
+
+/* run(scenario, seed)
+ * One run, from power on to the ball at rest after a confirmed shot, or the operator giving
+ * up once the retries are over, or the scenario timeout.
+ */
+static result_t run(const scenario_t *sc, uint32_t seed){
+
+	result_t res = {0};
+	plant_config_t cfg = sc->plant;
+	enum eputtState state = NB_STATES, prev = NB_STATES;
+	systime_t now = 0, entry = 0, search = 0, seen = 0, kick = 0, done = 0, window = 0;
+	uint32_t wakeups = 0, windows = 0, slid = 0, slide = MS2ST(sc->kick_slide_ms) ? MS2ST(sc->kick_slide_ms) : 1;
+	uint8_t tones = 0;
+	bool whistled = false, lost = false;
+	float charge_heading = 0;
+
+	rng_seed(seed);
+	cfg.ball_x += rng_uniform(-sc->ball_jitter, sc->ball_jitter);
+	cfg.ball_y += rng_uniform(-sc->ball_jitter, sc->ball_jitter);
+	cfg.heading += rng_uniform(-sc->heading_jitter, sc->heading_jitter);
+	cfg.wheel_bias += rng_uniform(-sc->bias_jitter, sc->bias_jitter);
+
+	chSysInit();
+	hw_init(plant_init(&cfg));
+	start_firmware();
+
+	while(now < MS2ST(sc->timeout_ms) && (!done || now < done))
+	{
+		sim_run_until(now + 1);
+		now = chVTGetSystemTime();
+
+		//the hold of LED_BLOCKING isn't a state
+		if(getState() != state && getState() < NB_STATES)
+		{
+			prev = state;
+			state = getState();
+			entry = now;
+			whistled = false;
+			if(state == SEARCH_BALL && !search)
+				search = now;
+			//BALL_LOCKED can be left in the same tick
+			if(!res.locked && state >= BALL_LOCKED && state <= SHOT_VERIFY)
+			{
+				res.locked = true;
+				res.lock_ms = ST2MS(now - search);
+			}
+			if(state == CHARGE_BALL && !plant_state().contact)
+				charge_heading = plant_state().heading;
+			if(state == SHOT_VERIFY)
+			{
+				res.shot = true;
+				res.shot_ms = ST2MS(now - search);
+			}
+			else if(state == STARTUP && prev == SHOT_VERIFY)
+			{
+				res.confirmed = true;
+				res.cycle_ms = getShotCycleStats().cycle_time_ms;
+			}
+			else if(state == MANUAL_MOVE && search && tones >= sc->tones)
+				break; //the retries are over and the operator gives up
+		}
+
+		//the operator whistles once the robot shows its state
+		if(!whistled && !res.confirmed && now - entry >= MS2ST(sc->operator_ms)
+		   && (state == STARTUP || (state == MANUAL_MOVE && tones < sc->tones)))
+		{
+			whistled = true;
+			if(state == MANUAL_MOVE)
+				tones++;
+			switchState(true);
+		}
+
+		//someone moves the ball out of the image once the robot has found it
+		if(state == SEARCH_BALL && !seen && ballSeenLast())
+			seen = now;
+		if(sc->kick_angle != 0 && seen && slid < slide && now - seen >= MS2ST(sc->kick_ms))
+		{
+			if(!res.kicked)
+				kick = now;
+			res.kicked = true;
+			plant_move_ball(sc->kick_angle/slide);
+			slid++;
+		}
+		if(res.kicked && !res.reacquired)
+		{
+			if(!ballSeenLast())
+				lost = true;
+			else if(lost)
+			{
+				res.reacquired = true;
+				res.reacquire_ms = ST2MS(now - kick);
+			}
+		}
+
+		if(now - window >= MS2ST(STATS_PERIOD_MS))
+		{
+			window = now;
+			if(now > MS2ST(STATS_PERIOD_MS))
+			{
+				wakeups += getRegulatorStats().wakeups;
+				windows++;
+			}
+		}
+
+		//the shot is over, until the ball stops
+		if(res.confirmed && !done)
+			done = now + MS2ST(SETTLE_MS);
+		if(done && plant_state().ball_speed == 0)
+			break;
+	}
+
+	res.contact = plant_state().contact;
+	res.lateral_mm = plant_state().lateral_mm;
+	res.launch_speed = plant_state().launch_speed;
+	res.drift = fabsf(plant_state().contact_heading - charge_heading);
+	res.scored = res.contact && cfg.goal_radius > 0 && plant_state().goal_miss_mm <= cfg.goal_radius;
+	res.wakeups = windows ? (float)wakeups/windows : 0;
+	res.motor_wakeups = now ? motor_arbiter_get_stats().cycles/(ST2MS(now)/1000.0f) : 0;
+	res.latency_max = motor_arbiter_get_stats().latency_max;
+	res.sim_ms = ST2MS(now);
+	return res;
+}
+
+static int compare(const void *a, const void *b){
+	return (*(const uint32_t *)a > *(const uint32_t *)b) - (*(const uint32_t *)a < *(const uint32_t *)b);
+}
+
+//p50 and p90 of n values, sorted in place
+static void percentiles(const char *label, uint32_t *values, uint16_t n, uint16_t runs){
+	if(n == 0)
+	{
+		printf("  %-32s      -      -   (0/%u)\n", label, runs);
+		return;
+	}
+	qsort(values, n, sizeof(values[0]), compare);
+	printf("  %-32s %6u %6u   (%u/%u)\n", label, values[(n - 1)/2], values[(n - 1)*9/10], n, runs);
+}
+
+/* report(scenario, results, jobs, wall time)
+ * Rates over the runs, times over the runs that got there.
+ */
+static void report(const scenario_t *sc, result_t *res, uint16_t n, uint16_t jobs, double wall_s){
+
+	static uint32_t values[MAX_RUNS];
+	uint16_t confirmed = 0, scored = 0, k = 0;
+	uint32_t latency_max = 0, median = 0;
+	double sim_s = 0, wakeups = 0, motor_wakeups = 0;
+
+	for(uint16_t i = 0 ; i < n ; i++)
+	{
+		confirmed += res[i].confirmed;
+		scored += res[i].scored;
+		sim_s += res[i].sim_ms/1000.0;
+		wakeups += res[i].wakeups;
+		motor_wakeups += res[i].motor_wakeups;
+		if(res[i].latency_max > latency_max)
+			latency_max = res[i].latency_max;
+	}
+	printf("%s [%s]: %u runs, %.0f s simulated in %.1f s, %.0fx real time on %u jobs\n",
+		   sc->name, SIM_VARIANT, n, sim_s, wall_s, sim_s/wall_s, jobs);
+	if(sc->plant.goal_radius > 0)
+		printf("  shots confirmed %.1f%%, scored %.1f%%\n", 100.0*confirmed/n, 100.0*scored/n);
+	else
+		printf("  shots confirmed %.1f%%, no goal\n", 100.0*confirmed/n);
+	printf("  %-32s %6s %6s\n", "", "p50", "p90");
+
+	for(uint16_t i = k = 0 ; i < n ; i++)
+		if(res[i].locked)
+			values[k++] = res[i].lock_ms;
+	percentiles("time to lock [ms]", values, k, n);
+	for(uint16_t i = k = 0 ; i < n ; i++)
+		if(res[i].confirmed)
+			values[k++] = res[i].shot_ms;
+	percentiles("time to shot [ms]", values, k, n);
+	for(uint16_t i = k = 0 ; i < n ; i++)
+		if(res[i].confirmed)
+			values[k++] = res[i].cycle_ms;
+	percentiles("cycle time [ms]", values, k, n);
+	for(uint16_t i = k = 0 ; i < n ; i++)
+		if(res[i].contact)
+			values[k++] = lroundf(res[i].lateral_mm);
+	percentiles("lateral error at impact [mm]", values, k, n);
+	//consistency of the shots: spread of the launch speed around its median
+	for(uint16_t i = k = 0 ; i < n ; i++)
+		if(res[i].contact)
+			values[k++] = lroundf(res[i].launch_speed);
+	percentiles("launch speed [mm/s]", values, k, n);
+	median = k ? values[(k - 1)/2] : 0;
+	for(uint16_t i = 0 ; i < k ; i++)
+		values[i] = values[i] > median ? values[i] - median : median - values[i];
+	percentiles("launch speed off median [mm/s]", values, k, n);
+	for(uint16_t i = k = 0 ; i < n ; i++)
+		if(res[i].contact)
+			values[k++] = lroundf(1000*res[i].drift);
+	percentiles("charge heading drift [mrad]", values, k, n);
+	if(sc->kick_angle != 0)
+	{
+		for(uint16_t i = k = 0 ; i < n ; i++)
+			if(res[i].reacquired)
+				values[k++] = res[i].reacquire_ms;
+		percentiles("time to reacquire [ms]", values, k, n);
+	}
+	printf("  wakeups %.1f/s, regulator %.1f/s and motors %.1f/s, frame to wheels max %u ms\n",
+		   (wakeups + motor_wakeups)/n, wakeups/n, motor_wakeups/n, latency_max);
+}
+
+/* run_batch(scenario, results, jobs, seed)
+ * Each run in a forked process, the firmware keeps its state in statics. A run writes its
+ * result on its own pipe before exiting, one that crashed is only counted as missing.
+ */
+static uint16_t run_batch(const scenario_t *sc, result_t *res, uint16_t jobs, uint32_t seed){
+
+	pid_t pid[jobs];
+	int fd[jobs][2];
+	uint16_t started = 0, received = 0, active = 0, slot = 0;
+	pid_t done = 0;
+
+	for(slot = 0 ; slot < jobs ; slot++)
+		pid[slot] = 0;
+	while(started < sc->runs || active)
+	{
+		if(started < sc->runs && active < jobs)
+		{
+			for(slot = 0 ; pid[slot] ; slot++);
+			if(pipe(fd[slot]) < 0)
+				break;
+			pid[slot] = fork();
+			if(pid[slot] == 0)
+			{
+				close(fd[slot][0]);
+				if(trace)
+					hw_trace_file = fopen(trace, "w");
+				res[0] = run(sc, seed + started);
+				if(hw_trace_file)
+					fclose(hw_trace_file);
+				_exit(write(fd[slot][1], &res[0], sizeof(res[0])) != sizeof(res[0]));
+			}
+			close(fd[slot][1]);
+			if(pid[slot] < 0)
+			{
+				close(fd[slot][0]);
+				pid[slot] = 0;
+				break;
+			}
+			started++;
+			active++;
+			continue;
+		}
+		done = wait(NULL);
+		for(slot = 0 ; slot < jobs && pid[slot] != done ; slot++);
+		if(slot == jobs)
+			continue;
+		if(read(fd[slot][0], &res[received], sizeof(res[0])) == sizeof(res[0]))
+			received++;
+		close(fd[slot][0]);
+		pid[slot] = 0;
+		active--;
+	}
+	while(active-- > 0)
+		wait(NULL);
+	return received;
+}
+
+int main(int argc, char **argv){
+
+	static scenario_t sc;
+	static result_t res[MAX_RUNS];
+	struct timespec start, end;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int runs = 0, opt = 0, status = 0;
+	uint32_t seed = 1;
+	uint16_t n = 0;
+
+	while((opt = getopt(argc, argv, "j:n:s:t:")) != -1)
+	{
+		if(opt == 'j')
+			jobs = atoi(optarg);
+		else if(opt == 'n')
+			runs = atoi(optarg);
+		else if(opt == 's')
+			seed = atoi(optarg);
+		else if(opt == 't')
+			trace = optarg;
+		else
+			return 2;
+	}
+	if(optind >= argc || jobs < 1 || runs < 0 || runs > MAX_RUNS)
+	{
+		fprintf(stderr, "usage: %s [-j jobs] [-n runs] [-s seed] [-t trace.csv] scenario...\n", argv[0]);
+		return 2;
+	}
+
+	for(int i = optind ; i < argc ; i++)
+	{
+		if(!parse(argv[i], &sc))
+			return 2;
+		if(runs)
+			sc.runs = runs;
+		if(trace)
+			sc.runs = jobs = 1;
+		if(sc.runs > MAX_RUNS)
+			sc.runs = MAX_RUNS;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		n = run_batch(&sc, res, jobs < sc.runs ? jobs : sc.runs, seed);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if(n != sc.runs)
+		{
+			fprintf(stderr, "%s: %u of %u runs completed\n", sc.name, n, sc.runs);
+			status = 1;
+		}
+		if(n)
+			report(&sc, res, n, jobs < sc.runs ? jobs : sc.runs,
+				   (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9);
+	}
+	return status;
+}
@@ -0,0 +1,34 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+//Minimal checks for the host tests: a failed check is reported and the test goes on,
+//test_end() gives the exit code.
+static int test_failures = 0, test_checks = 0;
+
+#define CHECK(cond) do { \
+	test_checks++; \
+	if(!(cond)) { \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+	} \
+} while(0)
+
+#define CHECK_NEAR(value, expected, tol) do { \
+	double v_ = (value), e_ = (expected); \
+	test_checks++; \
+	if(fabs(v_ - e_) > (tol)) { \
+		test_failures++; \
+		fprintf(stderr, "%s:%d: %s = %g, expected %g +- %g\n", __FILE__, __LINE__, #value, v_, e_, (double)(tol)); \
+	} \
+} while(0)
+
+static inline int test_end(const char *name){
+	printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+	return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif /* TEST_H */
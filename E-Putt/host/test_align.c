@@ -0,0 +1,241 @@
+/*
+ * align_detect.c: decisions on simple windows, then a replay of bearing error traces through
+ * the window and through the former counter (ALIGNED_CNT consecutive frames within
+ * ROTATION_THRESHOLD, a frame without the ball restarts it).
+ * The traces are synthetic: the error closes geometrically as under the bearing PID, which
+ * doesn't turn inside its deadband, with measurement noise, wrong detections and frames
+ * without the ball. Traces recorded with
+ * REGULATOR_TRACE can be given as arguments, the decisions are then only printed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <main.h>
+#include <align_detect.h>
+#include <regulator_tuning.h>
+#include "render.h"
+#include "test.h"
+
+#define GOAL_DISTANCE		(IMAGE_BUFFER_SIZE/2) //as eputt_regulator.c
+//former counter, after user-034
+#define ALIGNED_CNT			2
+
+#define FRAME_MS				66
+#define TRACE_FRAMES			60 //no decision within it counts as a time out
+#define TRACES				5000
+#define CLOSING_RATE			0.35f //fraction of the error corrected per frame
+#define OUTLIER_ERROR		100 //pxl, wrong detection on the scene
+
+static const align_config_t cfg = {
+	.window = ALIGN_WINDOW,
+	.min_samples = ALIGN_MIN_SAMPLES,
+	.threshold = ROTATION_THRESHOLD,
+	.confidence = ALIGN_CONFIDENCE,
+};
+
+typedef struct {
+	const char *name;
+	float noise;		//pxl, standard deviation of a measure
+	float outlier;		//probability of a wrong detection
+	float missed;		//probability of a frame without the ball
+} trace_model_t;
+
+static const trace_model_t models[] = {
+	{"clean", 2, 0, 0},
+	{"noisy", 5, 0, 0},
+	{"outliers", 2, 0.08f, 0},
+	{"missed", 2, 0, 0.15f},
+	{"field", 4, 0.05f, 0.10f},
+};
+
+typedef struct {
+	uint16_t frames[TRACES];	//to the decision
+	uint16_t wrong;				//decided with the true error out of ROTATION_THRESHOLD
+	uint16_t timeouts;
+} replay_t;
+
+static void add_window(align_window_t *align, const int16_t *error, uint8_t n){
+	align_reset(align);
+	for(uint8_t i = 0 ; i < n ; i++)
+		align_add(align, error[i]);
+}
+
+static int compare_u16(const void *a, const void *b){
+	return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+static uint16_t percentile(uint16_t *frames, uint16_t n, uint8_t p){
+	qsort(frames, n, sizeof(frames[0]), compare_u16);
+	return frames[(uint32_t)n*p/100];
+}
+
+/* replay(model, former counter or window, result)
+ * Same seed for both detectors: they see the very same traces.
+ */
+static void replay(const trace_model_t *model, bool counter, replay_t *result){
+
+	align_window_t align;
+	float truth = 0;
+	int16_t measure = 0;
+	uint8_t cnt = 0;
+	uint16_t k = 0;
+	bool seen = false, aligned = false;
+
+	memset(result, 0, sizeof(*result));
+	align_init(&align, &cfg);
+	rng_seed(46);
+	for(uint16_t n = 0 ; n < TRACES ; n++)
+	{
+		truth = rng_uniform(-200, 200);
+		align_reset(&align);
+		cnt = 0;
+		aligned = false;
+		for(k = 0 ; k < TRACE_FRAMES && !aligned ; k++)
+		{
+			seen = rng_uniform(0, 1) >= model->missed;
+			measure = truth + rng_gauss(model->noise);
+			if(rng_uniform(0, 1) < model->outlier)
+				measure = rng_uniform(-OUTLIER_ERROR, OUTLIER_ERROR);
+			if(counter)
+			{
+				if(seen && abs(measure) <= ROTATION_THRESHOLD)
+					cnt++;
+				else
+					cnt = 0;
+				aligned = cnt > ALIGNED_CNT;
+			}
+			else
+			{
+				if(seen)
+					align_add(&align, measure);
+				aligned = align_converged(&align);
+			}
+			if(aligned && fabsf(truth) > ROTATION_THRESHOLD)
+				result->wrong++;
+			//the bearing PID turns from the last measure, not inside its deadband
+			if(!aligned && seen && abs(measure) >= ROTATION_THRESHOLD)
+				truth -= CLOSING_RATE*measure;
+		}
+		if(!aligned)
+			result->timeouts++;
+		result->frames[n] = k;
+	}
+}
+
+/* replay_file(REGULATOR_TRACE output)
+ * time,state,seen,pos,... one line per fresh frame. Each search is replayed through both
+ * detectors, the frames they take to decide are printed.
+ */
+static void replay_file(const char *path){
+
+	FILE *file = fopen(path, "r");
+	align_window_t align;
+	unsigned time = 0, state = 0, seen = 0, pos = 0, prev_state = NB_STATES, start = 0;
+	unsigned counter_ms = 0, window_ms = 0;
+	uint8_t cnt = 0;
+	char line[128];
+
+	if(!file)
+	{
+		perror(path);
+		return;
+	}
+	align_init(&align, &cfg);
+	printf("%s: search start [ms], counter and window decisions [ms after]\n", path);
+	while(fgets(line, sizeof(line), file))
+	{
+		if(sscanf(line, "%u,%u,%u,%u", &time, &state, &seen, &pos) != 4)
+			continue;
+		if(state != prev_state)
+		{
+			if(prev_state == SEARCH_BALL)
+				printf("  %8u %8u %8u\n", start, counter_ms, window_ms);
+			align_reset(&align);
+			cnt = 0;
+			start = time;
+			counter_ms = window_ms = 0;
+			prev_state = state;
+		}
+		if(state != SEARCH_BALL)
+			continue;
+		cnt = seen && abs((int)pos - GOAL_DISTANCE) <= ROTATION_THRESHOLD ? cnt + 1 : 0;
+		if(!counter_ms && cnt > ALIGNED_CNT)
+			counter_ms = time - start;
+		if(seen)
+			align_add(&align, pos - GOAL_DISTANCE);
+		if(!window_ms && align_converged(&align))
+			window_ms = time - start;
+	}
+	if(prev_state == SEARCH_BALL)
+		printf("  %8u %8u %8u\n", start, counter_ms, window_ms);
+	fclose(file);
+}
+
+int main(int argc, char **argv){
+
+	static replay_t counter, window;
+	align_window_t align;
+	const int16_t centered[] = {3, -4, 2, -1, 5, 0};
+	const int16_t biased[] = {9, 11, 10, 12, 9, 11};
+	const int16_t one_outlier[] = {2, -3, 80, 1, 0, -2};
+	const int16_t scattered[] = {-14, 14, -13, 14, -14, 13};
+	uint16_t counter_p50 = 0, counter_p90 = 0, window_p50 = 0, window_p90 = 0;
+
+	align_init(&align, &cfg);
+
+	//no decision under ALIGN_MIN_SAMPLES, nor on an empty window
+	CHECK(!align_converged(&align));
+	add_window(&align, centered, ALIGN_MIN_SAMPLES - 1);
+	CHECK(!align_converged(&align));
+	add_window(&align, centered, ALIGN_MIN_SAMPLES);
+	CHECK(align_converged(&align));
+
+	//each sample within the threshold but a mean at its edge isn't enough
+	add_window(&align, biased, 6);
+	CHECK(!align_converged(&align));
+	//a scattered error centered on zero isn't either
+	add_window(&align, scattered, 6);
+	CHECK(!align_converged(&align));
+	//a single wrong detection is left out
+	add_window(&align, one_outlier, 6);
+	CHECK(align_converged(&align));
+
+	//the window only keeps the last samples: the old outliers are forgotten
+	add_window(&align, biased, 6);
+	for(uint8_t i = 0 ; i < ALIGN_WINDOW ; i++)
+		align_add(&align, centered[i]);
+	CHECK(align.n == ALIGN_WINDOW);
+	CHECK(align_converged(&align));
+
+	//two errors out of the threshold in a row: the robot turned, the window starts over
+	align_add(&align, 40);
+	CHECK(align.n == ALIGN_WINDOW);
+	align_add(&align, 30);
+	CHECK(align.n == 1);
+	CHECK(!align_converged(&align));
+
+	printf("align: model, time to charge p50 p90 [ms], wrong charges, time outs, counter -> window\n");
+	for(uint8_t m = 0 ; m < sizeof(models)/sizeof(models[0]) ; m++)
+	{
+		replay(&models[m], true, &counter);
+		replay(&models[m], false, &window);
+		counter_p50 = percentile(counter.frames, TRACES, 50)*FRAME_MS;
+		counter_p90 = percentile(counter.frames, TRACES, 90)*FRAME_MS;
+		window_p50 = percentile(window.frames, TRACES, 50)*FRAME_MS;
+		window_p90 = percentile(window.frames, TRACES, 90)*FRAME_MS;
+		printf("  %-9s %5u %5u -> %5u %5u   %4u -> %4u   %4u -> %4u\n", models[m].name,
+			   counter_p50, counter_p90, window_p50, window_p90,
+			   counter.wrong, window.wrong, counter.timeouts, window.timeouts);
+		//fewer wrong charges, and no slower
+		CHECK(window.wrong < counter.wrong);
+		CHECK(window.timeouts <= counter.timeouts);
+		CHECK(window_p50 <= counter_p50);
+		CHECK(window_p90 <= counter_p90);
+	}
+
+	for(int i = 1 ; i < argc ; i++)
+		replay_file(argv[i]);
+
+	return test_end("align");
+}
@@ -0,0 +1,111 @@
+/*
+ * ir_proximity.c: obstacle avoidance of the manual drive, with and without the ball
+ * seen in front by the camera, and with the ball seen elsewhere while a wall is ahead.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "hw.h"
+#include "test.h"
+
+#include <main.h>
+#include <ir_proximity.h>
+
+#define SPEED				700 //SPEED_MV_COMMAND
+#define NB_IR				8
+
+static int prox[NB_IR] = {0};
+static bool ball_seen = false;
+static uint16_t ball_pos = IMAGE_BUFFER_SIZE/2, ball_dist = 80;
+
+enum eputtState getState(void){
+	return MANUAL_MOVE;
+}
+
+bool ballSeenLast(void){
+	return ball_seen;
+}
+
+uint16_t getBallPos(void){
+	return ball_pos;
+}
+
+uint16_t getBallDistMm(void){
+	return ball_dist;
+}
+
+static int prox_value(uint8_t sensor){
+	return prox[sensor];
+}
+
+static const hw_backend_t backend = {
+	.prox = prox_value,
+};
+
+static void set_prox(int front_right, int right, int left, int front_left){
+	for(uint8_t i = 0 ; i < NB_IR ; i++)
+		prox[i] = 0;
+	prox[0] = front_right;
+	prox[1] = right;
+	prox[6] = left;
+	prox[7] = front_left;
+}
+
+static void drive(int16_t left_in, int16_t right_in, int16_t *left, int16_t *right){
+	*left = left_in;
+	*right = right_in;
+	obstacle_avoidance(left, right);
+}
+
+int main(void){
+
+	int16_t left = 0, right = 0;
+
+	chSysInit();
+	hw_init(&backend);
+
+	//free space: the command is left as it is
+	set_prox(20, 10, 10, 20);
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left == SPEED && right == SPEED);
+
+	//wall right ahead: no forward motion, rotations on place still allowed
+	set_prox(1500, 200, 200, 1500);
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left + right == 0);
+	drive(-SPEED, SPEED, &left, &right);
+	CHECK(left == -SPEED && right == SPEED);
+
+	//obstacle ahead on the left: slowed down and turning right
+	set_prox(100, 0, 300, 600);
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left + right < 2*SPEED);
+	CHECK(left > right);
+
+	//the same readings on the ball seen by the camera: driven straight into it
+	ball_seen = true;
+	set_prox(600, 0, 0, 600);
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left == SPEED && right == SPEED);
+	set_prox(1500, 0, 0, 400);
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left == SPEED && right == SPEED);
+
+	//the side sensors still steer away from a wall next to the ball
+	set_prox(1500, 0, 600, 1500);
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left + right == 2*SPEED);
+	CHECK(left > right);
+
+	//the ball at the edge of the image, or far: the wall right ahead still stops the robot
+	set_prox(1500, 200, 200, 1500);
+	ball_pos = 20;
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left + right == 0);
+	ball_pos = IMAGE_BUFFER_SIZE/2;
+	ball_dist = 300;
+	drive(SPEED, SPEED, &left, &right);
+	CHECK(left + right == 0);
+
+	return test_end("avoidance");
+}
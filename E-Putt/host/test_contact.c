@@ -0,0 +1,126 @@
+/*
+ * ir_proximity.c: contact with the ball during the charge, replayed from traces of the front
+ * proximity sensors. The flags are only raised in CHARGE_BALL and cleared in any other state.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "test.h"
+
+#include <main.h>
+#include <ir_proximity.h>
+
+#define IR_FRONT_RIGHT		0
+#define IR_FRONT_LEFT		7
+
+//front reading held for a duration
+typedef struct {
+	uint16_t ms;
+	int value;
+} prox_step_t;
+
+static enum eputtState state = CHARGE_BALL;
+static int front = 0;
+static systime_t now = 0;
+
+enum eputtState getState(void){
+	return state;
+}
+
+bool ballSeenLast(void){
+	return false;
+}
+
+uint16_t getBallPos(void){
+	return IMAGE_BUFFER_SIZE/2;
+}
+
+uint16_t getBallDistMm(void){
+	return 0;
+}
+
+static int prox_value(uint8_t sensor){
+	return (sensor == IR_FRONT_RIGHT || sensor == IR_FRONT_LEFT) ? front : 0;
+}
+
+static const hw_backend_t backend = {
+	.prox = prox_value,
+};
+
+//time [ms] from the start of the trace to each flag, -1 if never raised
+static void replay(const prox_step_t *trace, uint8_t nb, int32_t *contact_ms, int32_t *released_ms){
+
+	systime_t start = now;
+
+	*contact_ms = *released_ms = -1;
+	for(uint8_t k = 0 ; k < nb ; k++)
+	{
+		front = trace[k].value;
+		for(uint16_t t = 0 ; t < trace[k].ms ; t++)
+		{
+			sim_run_until(++now);
+			if(*contact_ms < 0 && ir_ball_contact())
+				*contact_ms = now - start;
+			if(*released_ms < 0 && ir_ball_released())
+				*released_ms = now - start;
+		}
+	}
+	front = 0;
+}
+
+int main(void){
+
+	int32_t contact = 0, released = 0;
+
+	//the ball is hit and rolls away
+	static const prox_step_t hit[] = {{200, 50}, {30, 900}, {60, 2600}, {30, 1200}, {30, 400}, {200, 30}};
+	//the ball is pushed and stays against the robot
+	static const prox_step_t pushed[] = {{200, 50}, {40, 1100}, {400, 2400}};
+	//reflections and the ball getting close without touching it
+	static const prox_step_t noise[] = {{100, 50}, {10, 1900}, {100, 50}, {20, 1500}, {50, 300},
+										{10, 1990}, {100, 80}, {200, 1800}, {100, 400}};
+
+	chSysInit();
+	hw_init(&backend);
+	ir_proximity_start();
+	sim_run_until(now = 100);
+
+	//touch then release: contact at the first reading over PROX_CONTACT, release once under
+	//PROX_RELEASE, not on the way down through the values in between
+	replay(hit, sizeof(hit)/sizeof(hit[0]), &contact, &released);
+	CHECK(contact >= 230 && contact <= 230 + HW_PROX_PERIOD_MS);
+	CHECK(released >= 320 && released <= 320 + HW_PROX_PERIOD_MS);
+	CHECK(ir_ball_contact() && ir_ball_released());
+
+	//leaving the charge clears both flags
+	state = SEARCH_BALL;
+	sim_run_until(now += 2*HW_PROX_PERIOD_MS);
+	CHECK(!ir_ball_contact() && !ir_ball_released());
+
+	//outside the charge nothing is raised
+	replay(hit, sizeof(hit)/sizeof(hit[0]), &contact, &released);
+	CHECK(contact < 0 && released < 0);
+
+	//touch without release
+	state = CHARGE_BALL;
+	replay(pushed, sizeof(pushed)/sizeof(pushed[0]), &contact, &released);
+	CHECK(contact >= 240 && contact <= 240 + HW_PROX_PERIOD_MS);
+	CHECK(released < 0);
+	CHECK(ir_ball_contact() && !ir_ball_released());
+
+	//a fresh charge starts without the flags of the previous one
+	state = SHOT_VERIFY;
+	sim_run_until(now += 2*HW_PROX_PERIOD_MS);
+	state = CHARGE_BALL;
+	sim_run_until(now += 2*HW_PROX_PERIOD_MS);
+	CHECK(!ir_ball_contact() && !ir_ball_released());
+
+	//spikes and a close pass under PROX_CONTACT are no contact, and the drops after them
+	//no release
+	replay(noise, sizeof(noise)/sizeof(noise[0]), &contact, &released);
+	CHECK(contact < 0 && released < 0);
+
+	return test_end("contact");
+}
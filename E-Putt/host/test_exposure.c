@@ -0,0 +1,104 @@
+/*
+ * Exposure control of process_image.c with the sensor of camera_model.c: the exposure is
+ * lengthened first, the gain takes over at EXPOSURE_MAX, the threshold margin follows the gain,
+ * and the sensor AE and the default gains are back once the tracking stops.
+ */
+#include <stdio.h>
+
+#include "../process_image.c"
+#include "kernel.h"
+#include "hw.h"
+#include "camera_model.h"
+#include "test.h"
+
+#define BALL_LEFT			270
+#define BALL_RIGHT			360
+#define NOISE				4
+#define SETTLE_MS			2000
+
+static enum eputtState state = SEARCH_BALL;
+static float room_light = 1;
+
+enum eputtState getState(void){
+	return state;
+}
+
+void switchState(bool success){
+	(void)success;
+}
+
+static void render(uint8_t *band, uint16_t width, uint16_t lines, bool yuv){
+	scene_t scene = {.ball_left = BALL_LEFT, .ball_right = BALL_RIGHT, .ball_lines = lines};
+	camera_expose(&scene, room_light, NOISE);
+	render_band(band, width, lines, yuv, &scene);
+}
+
+static uint16_t frame_period_ms(void){
+	return camera_frame_period_ms(room_light);
+}
+
+static const hw_backend_t backend = {
+	.render = render,
+	.frame_period_ms = frame_period_ms,
+};
+
+int main(void){
+
+	systime_t t = 0;
+
+	chSysInit();
+	hw_init(&backend);
+	capture_process_img_start();
+
+	//a dim room, still under the cap: the exposure alone is lengthened
+	room_light = 0.5f;
+	sim_run_until(t += SETTLE_MS);
+	CHECK(!hw_camera().ae);
+	CHECK(exposure > EXPOSURE_INIT && exposure < EXPOSURE_MAX);
+	CHECK(gain == GAIN_UNITY);
+	CHECK(threshold_margin == 0);
+	CHECK(hw_camera().gain_r == RED_GAIN_DEFAULT);
+	CHECK(getCaptureFps() >= TARGET_FPS);
+	CHECK(ballSeenLast());
+
+	//darker: the exposure stays capped, the gain takes over and widens the threshold margin
+	room_light = 0.12f;
+	sim_run_until(t += SETTLE_MS);
+	CHECK(exposure == EXPOSURE_MAX);
+	CHECK(gain > GAIN_UNITY);
+	CHECK(threshold_margin > 0);
+	CHECK(threshold_margin == (gain - GAIN_UNITY) >> GAIN_MARGIN_SHIFT);
+	CHECK(hw_camera().exposure == EXPOSURE_MAX);
+	CHECK(hw_camera().gain_r == scale_gain(RED_GAIN_DEFAULT));
+	CHECK(hw_camera().gain_r > RED_GAIN_DEFAULT);
+	CHECK(getCaptureFps() >= TARGET_FPS);
+	CHECK(getDetectionRate() >= 90);
+
+	//bright again: the gain goes back to unity before the exposure is shortened
+	room_light = 2;
+	sim_run_until(t += SETTLE_MS);
+	CHECK(gain == GAIN_UNITY);
+	CHECK(threshold_margin == 0);
+	CHECK(exposure < EXPOSURE_INIT);
+	CHECK(ballSeenLast());
+
+	//leaving the tracking: sensor AE, default gains and no margin
+	room_light = 0.12f;
+	sim_run_until(t += SETTLE_MS);
+	state = CHARGE_BALL;
+	sim_run_until(t += SETTLE_MS);
+	CHECK(hw_camera().ae);
+	CHECK(hw_camera().gain_r == RED_GAIN_DEFAULT);
+	CHECK(hw_camera().gain_g == GREEN_GAIN_DEFAULT);
+	CHECK(hw_camera().gain_b == BLUE_GAIN_DEFAULT);
+	CHECK(threshold_margin == 0);
+
+	//and back: the capped exposure is restored
+	state = SEARCH_BALL;
+	sim_run_until(t += SETTLE_MS);
+	CHECK(!hw_camera().ae);
+	CHECK(exposure == EXPOSURE_MAX);
+	CHECK(getCaptureFps() >= TARGET_FPS);
+
+	return test_end("exposure");
+}
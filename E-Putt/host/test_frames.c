@@ -0,0 +1,110 @@
+/*
+ * Frame acquisition of process_image.c: blocking wait with a deadline, lost frames,
+ * slow auto exposure frames outside tracking, numbering of every frame.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "render.h"
+#include "test.h"
+
+#include <main.h>
+#include <process_image.h>
+
+#define BALL_LEFT			270
+#define BALL_RIGHT			370
+#define AE_FRAME_MS			400 //sensor auto exposure in a dim room
+#define MAX_RESULT_AGE_MS	132
+
+static enum eputtState state = SEARCH_BALL;
+static uint8_t lose = 0;
+
+enum eputtState getState(void){
+	return state;
+}
+
+void switchState(bool success){
+	(void)success;
+}
+
+static void render(uint8_t *band, uint16_t width, uint16_t lines, bool yuv){
+	scene_t scene = {.ball_left = BALL_LEFT, .ball_right = BALL_RIGHT, .ball_lines = lines, .light = 1, .noise = 8};
+	render_band(band, width, lines, yuv, &scene);
+}
+
+//the firmware caps the exposure while tracking, the sensor AE doesn't
+static uint16_t frame_period_ms(void){
+	return hw_camera().ae ? AE_FRAME_MS : HW_FRAME_PERIOD_MS;
+}
+
+static bool frame_lost(void){
+	if(!lose)
+		return false;
+	lose--;
+	return true;
+}
+
+static const hw_backend_t backend = {
+	.render = render,
+	.frame_period_ms = frame_period_ms,
+	.frame_lost = frame_lost,
+};
+
+int main(void){
+
+	uint32_t seq = 0;
+	uint16_t seen_false = 0, stale_seen = 0;
+
+	chSysInit();
+	hw_init(&backend);
+	capture_process_img_start();
+
+	//tracking: one frame per period, the ball is found
+	sim_run_until(1000);
+	CHECK(getFrameSeq() >= 13);
+	CHECK(getFrameStats().dropped == 0);
+	CHECK(getFrameStats().late == 0);
+	CHECK(ballSeenLast());
+	CHECK_NEAR(getBallPos(), (BALL_LEFT + BALL_RIGHT)/2, 8);
+	//the worst-case lines were timed before the first capture, without leaving a detection
+	CHECK(getExtractTiming().worst_case > 0);
+	CHECK(getExtractTiming().overruns == 0);
+
+	//two captures lost: the result is never used once older than MAX_RESULT_AGE_MS
+	lose = 2;
+	for(systime_t t = 1001 ; t <= 1800 ; t++)
+	{
+		sim_run_until(t);
+		if(!ballSeenLast())
+			seen_false++;
+		else if(chVTGetSystemTime() - getFrameTime() > MAX_RESULT_AGE_MS)
+			stale_seen++;
+	}
+	CHECK(getFrameStats().dropped == 2);
+	CHECK(getFrameStats().recovered == 1);
+	CHECK(seen_false > 0);
+	CHECK(stale_seen == 0);
+	CHECK(ballSeenLast());
+
+	//outside tracking the AE frames are slower than FRAME_TIMEOUT_MS but not lost,
+	//they are still numbered and nothing is seen on them
+	state = CHARGE_BALL;
+	sim_run_until(2000);
+	seq = getFrameSeq();
+	sim_run_until(4000);
+	CHECK(getFrameStats().dropped == 2);
+	CHECK(getFrameSeq() - seq >= 4);
+	CHECK(!ballSeenLast());
+	CHECK(chVTGetSystemTime() - getFrameTime() <= AE_FRAME_MS);
+
+	//back to tracking: the exposure is capped before the next capture, no drop or late frame
+	state = SEARCH_BALL;
+	sim_run_until(5000);
+	CHECK(getFrameStats().dropped == 2);
+	CHECK(getFrameStats().late == 0);
+	CHECK(ballSeenLast());
+
+	return test_end("frames");
+}
@@ -0,0 +1,110 @@
+/*
+ * led_sequencer.c: frames of a pattern on the virtual timer over the steady leds, a pattern
+ * replaced while playing, the steady leds changed under a pattern. Then with state_machine.c:
+ * a transition plays its pattern without waiting for it.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "test.h"
+
+#include <main.h>
+#include <state_machine.h>
+#include <led_sequencer.h>
+
+#define STEP_MS				200 //PATTERN_STEP_MS
+#define FRAMES				8
+
+static const hw_backend_t backend = {0};
+
+//runs to t [ms] from the start of the test
+static void run_to(systime_t t){
+	sim_run_until(MS2ST(t));
+}
+
+int main(void){
+
+	chSysInit();
+	hw_init(&backend);
+	led_sequencer_start();
+
+	//steady leds are lit right away, nothing else
+	led_sequencer_set_steady(SEQ_LED1);
+	CHECK(hw_leds() == SEQ_LED1);
+
+	//a blinking pattern over them: the leds it doesn't drive stay steady, one frame per step,
+	//and it ends on the steady leds
+	run_to(100);
+	led_sequencer_play(PATTERN_BALL_NF);
+	CHECK(hw_leds() == (SEQ_LED1 | SEQ_FRONT));
+	for(uint8_t f = 1 ; f < FRAMES ; f++)
+	{
+		run_to(100 + f*STEP_MS - 1);
+		CHECK(hw_leds() == (f % 2 ? SEQ_LED1 | SEQ_FRONT : SEQ_LED1));
+		run_to(100 + f*STEP_MS);
+		CHECK(hw_leds() == (f % 2 ? SEQ_LED1 : SEQ_LED1 | SEQ_FRONT));
+	}
+	run_to(100 + FRAMES*STEP_MS);
+	CHECK(hw_leds() == SEQ_LED1);
+	run_to(3000);
+	CHECK(hw_leds() == SEQ_LED1);
+
+	//a pattern driving the steady led: it follows the pattern, then is back steady
+	led_sequencer_play(PATTERN_MV_SB);
+	CHECK(hw_leds() == SEQ_LED1);
+	run_to(3000 + 2*STEP_MS);
+	CHECK(hw_leds() == (SEQ_LED1 | SEQ_LED3 | SEQ_LED5));
+	run_to(3000 + 5*STEP_MS);
+	CHECK(hw_leds() == (SEQ_LED5 | SEQ_LED7));
+
+	//replaced while playing: the new one starts from its first frame, on its own period,
+	//and the leds of the former one are back steady
+	led_sequencer_play(PATTERN_SUCCESS);
+	CHECK(hw_leds() == (SEQ_LED1 | SEQ_BODY));
+	run_to(3000 + 5*STEP_MS + STEP_MS - 1);
+	CHECK(hw_leds() == (SEQ_LED1 | SEQ_BODY));
+	run_to(3000 + 5*STEP_MS + STEP_MS);
+	CHECK(hw_leds() == SEQ_LED1);
+
+	//the steady leds change under a pattern, the pattern goes on
+	led_sequencer_set_steady(SEQ_LED3 | SEQ_LED7);
+	CHECK(hw_leds() == (SEQ_LED3 | SEQ_LED7));
+	run_to(3000 + 5*STEP_MS + 2*STEP_MS);
+	CHECK(hw_leds() == (SEQ_LED3 | SEQ_LED7 | SEQ_BODY));
+	run_to(6000);
+	CHECK(hw_leds() == (SEQ_LED3 | SEQ_LED7));
+
+	//nothing to play
+	led_sequencer_play(PATTERN_NONE);
+	CHECK(hw_leds() == (SEQ_LED3 | SEQ_LED7));
+
+	//the operator tone: the search starts at once, its leds animated over it
+	chSysInit();
+	hw_init(&backend);
+	led_sequencer_start();
+	state_machine_start();
+	CHECK(hw_leds() == (SEQ_LED3 | SEQ_LED7));
+	switchState(true);
+	sim_run_until(10);
+	CHECK(getState() == MANUAL_MOVE);
+	CHECK(hw_leds() == SEQ_BODY);
+	switchState(true);
+	sim_run_until(11);
+	CHECK(getState() == SEARCH_BALL);
+	CHECK(hw_leds() == SEQ_LED1);
+	sim_run_until(11 + 2*STEP_MS);
+	CHECK(hw_leds() == (SEQ_LED1 | SEQ_LED3 | SEQ_LED5));
+	//ball not found: backing off while the front led blinks, the search leds are off
+	switchState(false);
+	sim_run_until(12 + 2*STEP_MS);
+	CHECK(getState() == RETRY_BACKOFF);
+	CHECK(hw_leds() == SEQ_FRONT);
+	//the back off ends before the pattern, the search goes on under it
+	sim_run_until(12 + 2*STEP_MS + FRAMES*STEP_MS);
+	CHECK(getState() == SEARCH_BALL);
+	CHECK(hw_leds() == SEQ_LED1);
+
+	return test_end("leds");
+}
@@ -0,0 +1,67 @@
+/*
+ * odometry.c: yaw integrated from the gyro samples and heading from the wheel steps.
+ * Also built with a 10kHz system tick and an IMU period that isn't a whole number of
+ * milliseconds, where the integration must use the real period.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "test.h"
+
+#include <main.h>
+#include <motors.h>
+#include <odometry.h>
+
+#define RATE				0.8f //[rad/s]
+#define RUN_S			10
+
+static float rate = 0;
+
+static float gyro_z(void){
+	return rate;
+}
+
+static const hw_backend_t backend = {
+	.gyro_z = gyro_z,
+};
+
+int main(void){
+
+	float yaw = 0;
+
+	chSysInit();
+	hw_init(&backend);
+	odometry_start();
+	sim_run_until(MS2ST(100));
+	yaw = odometry_get_yaw();
+	CHECK(yaw == 0);
+
+	//constant rate: the yaw follows within one IMU period
+	rate = RATE;
+	sim_run_until(chVTGetSystemTime() + S2ST(RUN_S));
+	CHECK_NEAR(odometry_get_yaw() - yaw, RATE*RUN_S, RATE*2*HW_IMU_PERIOD_US/1e6);
+
+	//back and forth: no drift
+	yaw = odometry_get_yaw();
+	for(uint8_t k = 0 ; k < 10 ; k++)
+	{
+		rate = (k % 2) ? -RATE : RATE;
+		sim_run_until(chVTGetSystemTime() + MS2ST(500));
+	}
+	rate = 0;
+	sim_run_until(chVTGetSystemTime() + MS2ST(100));
+	CHECK_NEAR(odometry_get_yaw(), yaw, RATE*2*HW_IMU_PERIOD_US/1e6);
+
+	//turn on place: half a turn of difference between the wheels
+	left_motor_set_speed(-500);
+	right_motor_set_speed(500);
+	sim_run_until(chVTGetSystemTime() + S2ST(1));
+	left_motor_set_speed(0);
+	right_motor_set_speed(0);
+	CHECK_NEAR(odometry_get_heading(), 1000.0f*WHEEL_PERIMETER_MM/(NSTEP_ONE_TURN*WHEEL_DISTANCE_MM), 0.01);
+
+	return test_end(CH_CFG_ST_FREQUENCY == 1000 ? "odometry" : "odometry, fast tick");
+}
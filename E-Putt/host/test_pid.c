@@ -0,0 +1,163 @@
+/*
+ * pid.c: deadband, anti-windup and slew limit, then the step response of the bearing loop
+ * against the former pi_regulator() on a model of the robot turning in place.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "test.h"
+
+#include <main.h>
+#include <motors.h>
+#include <pid.h>
+#include <regulator_tuning.h>
+
+//the former regulator, with its gains
+#define OLD_KP				0.5f
+#define OLD_KI				0.15f
+#define OLD_MAX_SUM_ERROR	(MOTOR_SPEED_LIMIT/(5*OLD_KI))
+
+#define FRAME_S				0.066f
+#define STEP_FRAMES			150
+//pixels moved in one frame per step/s of rotation command, both wheels turning
+#define PLANT_GAIN			(FOCAL_PXL*2.0f*WHEEL_PERIMETER_MM/NSTEP_ONE_TURN/WHEEL_DISTANCE_MM*FRAME_S)
+
+static const pid_config_t bearing_cfg = {
+	.kp = KP,
+	.ki = KI,
+	.kd = 0,
+	.leak = KI_PRIOR,
+	.int_max = MAX_SUM_ERROR,
+	.deadband = ROTATION_THRESHOLD,
+	.out_max = MOTOR_SPEED_LIMIT,
+	.slew_max = 0,
+};
+
+static int16_t sum_error = 0;
+
+//pi_regulator() of the first version, integral in an int16_t
+static int16_t pi_regulator(uint16_t distance, uint16_t goal){
+
+	int16_t error = distance - goal;
+
+	if(abs(error) < ROTATION_THRESHOLD)
+		return 0;
+	sum_error = sum_error*KI_PRIOR + error;
+	if(sum_error > OLD_MAX_SUM_ERROR)
+		sum_error = OLD_MAX_SUM_ERROR;
+	else if(sum_error < -OLD_MAX_SUM_ERROR)
+		sum_error = -OLD_MAX_SUM_ERROR;
+	return OLD_KP*error + OLD_KI*sum_error;
+}
+
+/* settling(new controller, initial offset [pxl], frames of delay, overshoot)
+ * Frames until the ball stays within ROTATION_THRESHOLD of the center, STEP_FRAMES if never.
+ * The command applies delay frames after the image it was computed from.
+ */
+static uint16_t settling(bool pid, float offset, uint8_t delay, float *overshoot){
+
+	pid_ctrl_t ctrl;
+	float command[3] = {0};
+	uint16_t settled = STEP_FRAMES;
+	int16_t pos = 0;
+
+	pid_init(&ctrl, &bearing_cfg);
+	sum_error = 0;
+	*overshoot = 0;
+	for(uint16_t k = 0 ; k < STEP_FRAMES ; k++)
+	{
+		pos = lroundf(offset) + IMAGE_BUFFER_SIZE/2;
+		for(uint8_t d = delay ; d > 0 ; d--)
+			command[d] = command[d - 1];
+		command[0] = pid ? pid_update(&ctrl, pos - IMAGE_BUFFER_SIZE/2, 0) : pi_regulator(pos, IMAGE_BUFFER_SIZE/2);
+		offset -= PLANT_GAIN*command[delay];
+
+		if(offset < 0 && -offset > *overshoot)
+			*overshoot = -offset;
+		if(fabsf(offset) >= ROTATION_THRESHOLD)
+			settled = STEP_FRAMES;
+		else if(settled == STEP_FRAMES)
+			settled = k;
+	}
+	return settled;
+}
+
+static void check_deadband(void){
+
+	pid_ctrl_t ctrl;
+
+	pid_init(&ctrl, &bearing_cfg);
+	pid_update(&ctrl, 50, 0);
+	pid_update(&ctrl, 40, 0);
+	float integral = ctrl.integral;
+
+	//inside the deadband: feedforward only, the integral is neither leaked nor increased
+	CHECK(pid_update(&ctrl, ROTATION_THRESHOLD - 1, 25) == 25);
+	CHECK(ctrl.integral == integral);
+	CHECK(pid_update(&ctrl, -(ROTATION_THRESHOLD - 1), 0) == 0);
+	CHECK(ctrl.integral == integral);
+	//and it resumes from there
+	CHECK_NEAR(pid_update(&ctrl, 20, 0), KP*20 + KI*(integral*KI_PRIOR + 20), 1e-3);
+}
+
+static void check_windup(void){
+
+	pid_ctrl_t ctrl;
+
+	pid_init(&ctrl, &bearing_cfg);
+	//saturated toward the error: the integral only leaks
+	for(uint8_t k = 0 ; k < 50 ; k++)
+		CHECK(pid_update(&ctrl, 2000, 0) == MOTOR_SPEED_LIMIT);
+	CHECK(ctrl.integral <= 2000);
+	CHECK(ctrl.integral <= MAX_SUM_ERROR);
+	//so it comes back at once when the error changes sign
+	CHECK(pid_update(&ctrl, -300, 0) < 0);
+}
+
+static void check_slew(void){
+
+	const pid_config_t cfg = {.kp = 1, .deadband = 0, .leak = 1, .int_max = 100, .out_max = 1000, .slew_max = 50};
+	pid_ctrl_t ctrl;
+
+	pid_init(&ctrl, &cfg);
+	CHECK(pid_update(&ctrl, 500, 0) == 50);
+	CHECK(pid_update(&ctrl, 500, 0) == 100);
+	CHECK(pid_update(&ctrl, -500, 0) == 50);
+}
+
+int main(void){
+
+	static const float offsets[] = {30, 60, 100, 150, 200, 250, 300};
+	uint16_t old_total = 0, new_total = 0, old_max = 0, new_max = 0, t = 0, t_old = 0;
+	float overshoot = 0;
+
+	check_deadband();
+	check_windup();
+	check_slew();
+
+	printf("step response, frames to settle (overshoot [pxl]) old / new\n");
+	for(uint8_t delay = 1 ; delay <= 2 ; delay++)
+	{
+		old_total = new_total = old_max = new_max = 0;
+		for(uint8_t i = 0 ; i < sizeof(offsets)/sizeof(offsets[0]) ; i++)
+		{
+			printf("  delay %u, offset %3.0f:", delay, offsets[i]);
+			t_old = settling(false, offsets[i], delay, &overshoot);
+			printf(" %3u (%3.0f)", t_old, overshoot);
+			old_total += t_old;
+			old_max = t_old > old_max ? t_old : old_max;
+			t = settling(true, offsets[i], delay, &overshoot);
+			printf(" / %3u (%3.0f)\n", t, overshoot);
+			new_total += t;
+			new_max = t > new_max ? t : new_max;
+			//no offset settles slower than before, one frame late or two
+			CHECK(t <= t_old);
+		}
+		CHECK(new_max < STEP_FRAMES);
+		CHECK(new_max < old_max);
+		CHECK(new_total < old_total);
+	}
+
+	return test_end("pid");
+}
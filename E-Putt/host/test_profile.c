@@ -0,0 +1,160 @@
+/*
+ * motion_profile.c: limits of the S-curve, the soft charge followed on a trace of the
+ * profile, braking distance.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include <motors.h>
+
+#include "../motion_profile.c"
+#include "test.h"
+
+#define DT					(MOTOR_UPDATE_MS/MS_PER_S)
+#define MAX_STEPS			2000 //of DT
+#define CHARGE_SPEED			(MOTOR_SPEED_LIMIT - 100) //as eputt_regulator.c
+
+//the profile is tested alone
+enum eputtState getState(void){
+	return CHARGE_BALL;
+}
+
+float odometry_get_yaw(void){
+	return 0;
+}
+
+int8_t motor_arbiter_resolve(int16_t *left, int16_t *right){
+	*left = *right = 0;
+	return -1;
+}
+
+static int16_t written_left = 0, written_right = 0;
+
+void motor_arbiter_write(int16_t left, int16_t right){
+	written_left = left;
+	written_right = right;
+}
+
+void obstacle_avoidance(int16_t *left, int16_t *right){
+}
+
+/* check_scurve(from, to, acceleration limit)
+ * Runs the profile to the target and checks the trace: speed monotonic and never past the
+ * target, acceleration and jerk within their limits. Returns the time taken [s].
+ */
+static float check_scurve(float from, float to, float accel_limit){
+
+	profile_t profile;
+	float prev_speed = from, prev_accel = 0, jerk_peak = 0, accel_peak = 0;
+	uint16_t k = 0;
+
+	profile_init(&profile, &wheel_profile_cfg);
+	profile.accel_limit = accel_limit;
+	profile.speed = from;
+
+	for(k = 0 ; k < MAX_STEPS && profile.speed != to ; k++)
+	{
+		profile_update(&profile, to, DT);
+		CHECK((to - from)*(profile.speed - prev_speed) >= 0);
+		CHECK((to - from)*(to - profile.speed) >= 0);
+		if(fabsf(profile.accel) > accel_peak)
+			accel_peak = fabsf(profile.accel);
+		//the last step only clears the acceleration, when the target is reached
+		if(profile.speed != to && fabsf(profile.accel - prev_accel)/DT > jerk_peak)
+			jerk_peak = fabsf(profile.accel - prev_accel)/DT;
+		prev_speed = profile.speed;
+		prev_accel = profile.accel;
+	}
+	CHECK(profile.speed == to);
+	CHECK(accel_peak <= accel_limit + 1e-3f);
+	CHECK(jerk_peak <= JERK_MAX*(1 + 1e-4f));
+	return k*DT;
+}
+
+/* charge_trace()
+ * Starts the charge then follows the profile from rest: returns the distance [mm] at which
+ * the charge speed is reached.
+ */
+static float charge_trace(void){
+
+	float travelled = 0;
+
+	profile_init(&left_profile, &wheel_profile_cfg);
+	motion_soft_charge();
+	for(uint16_t k = 0 ; k < MAX_STEPS && left_profile.speed < CHARGE_SPEED ; k++)
+	{
+		profile_update(&left_profile, CHARGE_SPEED, DT);
+		travelled += STEPS_TO_MM(left_profile.speed*DT);
+	}
+	CHECK(left_profile.speed == CHARGE_SPEED);
+	return travelled;
+}
+
+//distance to stop from speed with the full deceleration
+static float braking_trace(float speed){
+
+	profile_t profile;
+	float travelled = 0;
+
+	profile_init(&profile, &wheel_profile_cfg);
+	profile.speed = speed;
+	for(uint16_t k = 0 ; k < MAX_STEPS && profile.speed > 0 ; k++)
+	{
+		profile_update(&profile, 0, DT);
+		travelled += STEPS_TO_MM(profile.speed*DT);
+	}
+	return travelled;
+}
+
+int main(void){
+
+	float t = 0, reached = 0;
+
+	//full and charge accelerations, up and down, small and large steps
+	t = check_scurve(0, MOTOR_SPEED_LIMIT, ACCEL_MAX);
+	//a trapezoid of acceleration: v/a + a/j, the last steps are cut when the target is passed
+	CHECK_NEAR(t, MOTOR_SPEED_LIMIT/ACCEL_MAX + ACCEL_MAX/JERK_MAX, 3*DT);
+	check_scurve(MOTOR_SPEED_LIMIT, -MOTOR_SPEED_LIMIT, ACCEL_MAX);
+	check_scurve(0, 50, ACCEL_MAX);
+	check_scurve(CHARGE_SPEED, 0, ACCEL_CHARGE);
+
+	//the soft charge: v^2/(2a) plus the jerk ramps, whatever the distance to the ball
+	reached = charge_trace();
+	printf("charge: acceleration %.0f, charge speed reached at %.1f mm\n", left_profile.accel_limit, reached);
+	CHECK(left_profile.accel_limit == ACCEL_CHARGE);
+	CHECK_NEAR(reached, STEPS_TO_MM((float)CHARGE_SPEED*CHARGE_SPEED/(2*ACCEL_CHARGE)
+							   + CHARGE_SPEED*ACCEL_CHARGE/(2*JERK_MAX)), 2);
+	CHECK(reached <= 50);
+
+	//the announced braking distance is enough, and not much more than needed
+	for(uint16_t speed = 200 ; speed <= MOTOR_SPEED_LIMIT ; speed += 300)
+	{
+		CHECK(braking_trace(speed) <= motion_braking_mm(speed) + 1);
+		CHECK(motion_braking_mm(speed) <= 1.5f*braking_trace(speed) + 5);
+	}
+
+	//the heading hold is applied whole at the charge speed: a wheel over the limit gives its
+	//excess to the other one, on both sides and in reverse
+	write_corrected(CHARGE_SPEED, CHARGE_SPEED, 20);
+	CHECK(written_left == CHARGE_SPEED + 20 && written_right == CHARGE_SPEED - 20);
+	write_corrected(CHARGE_SPEED, CHARGE_SPEED, HOLD_MAX);
+	CHECK(written_left == MOTOR_SPEED_LIMIT);
+	CHECK(written_left - written_right == 2*HOLD_MAX);
+	write_corrected(CHARGE_SPEED, CHARGE_SPEED, -HOLD_MAX);
+	CHECK(written_right == MOTOR_SPEED_LIMIT);
+	CHECK(written_left - written_right == -2*HOLD_MAX);
+	write_corrected(-CHARGE_SPEED, -CHARGE_SPEED, HOLD_MAX);
+	CHECK(written_right == -MOTOR_SPEED_LIMIT);
+	CHECK(written_left - written_right == 2*HOLD_MAX);
+	write_corrected(MOTOR_SPEED_LIMIT, -MOTOR_SPEED_LIMIT, 0);
+	CHECK(written_left == MOTOR_SPEED_LIMIT && written_right == -MOTOR_SPEED_LIMIT);
+
+	//the braking of the charge is computed from the speed the profiles reached
+	left_profile.speed = 600;
+	right_profile.speed = 400;
+	CHECK(motion_get_speed() == 500);
+	right_profile.speed = -600;
+	CHECK(motion_get_speed() == 0);
+
+	return test_end("profile");
+}
@@ -0,0 +1,180 @@
+/*
+ * Transition queue of state_machine.c under load: several threads end states at random times,
+ * from random interleavings (sim_shuffle), some of them delayed between reading the state and
+ * posting (sim_post_hook). Every transition applied must be one of the table, every post must
+ * be applied or discarded, and none may wait in the queue. Then a late post on a state left
+ * and entered again (A-B-A), and posts from a thread above the owner.
+ * Built with timeouts longer than the runs: every transition is a post.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "render.h"
+#include "test.h"
+
+#include <main.h>
+#include <state_machine.h>
+#include <led_sequencer.h>
+
+#define POSTERS				4
+#define SEEDS				20
+#define RUN_MS				5000
+#define POST_PERIOD_MS		8 //at most, between two posts of a thread
+#define DELAY_MS				3 //at most, between reading the state and posting
+#define BURST				24 //posts in a row from above the owner
+#define STATE_QUEUE_SIZE		8 //as state_machine.c
+#define STATE_OWNER_PRIO		(NORMALPRIO+2)
+
+//transitions of state_table, on failure and on success
+static const enum eputtState next[NB_STATES][2] = {
+	[STARTUP]		= {MANUAL_MOVE, MANUAL_MOVE},
+	[MANUAL_MOVE]	= {SEARCH_BALL, SEARCH_BALL},
+	[SEARCH_BALL]	= {RETRY_BACKOFF, BALL_LOCKED},
+	[BALL_LOCKED]	= {RETRY_BACKOFF, CHARGE_BALL},
+	[CHARGE_BALL]	= {RETRY_BACKOFF, SHOT_VERIFY},
+	[SHOT_VERIFY]	= {RETRY_BACKOFF, STARTUP},
+	[RETRY_BACKOFF]	= {MANUAL_MOVE, SEARCH_BALL},
+};
+
+static enum eputtState leaving = NB_STATES;
+static uint32_t transitions = 0, invalid = 0, posts = 0;
+static cnt_t queued_max = 0;
+static bool posting = false;
+static thread_t *delayed = NULL; //only this thread is delayed, NULL for all of them
+static systime_t delay = 0;
+
+//called by the owner before the state changes, then set_steady() after
+void led_sequencer_play(enum ledPattern pattern){
+	leaving = getState();
+}
+
+void led_sequencer_set_steady(uint8_t leds){
+	if(leaving == NB_STATES)
+		return; //entry in STARTUP at start
+	if(getState() != next[leaving][0] && getState() != next[leaving][1])
+		invalid++;
+	transitions++;
+	leaving = NB_STATES;
+}
+
+static void post_hook(mailbox_t *mbp, msg_t msg){
+	posts++;
+	if(mbp->cnt > queued_max)
+		queued_max = mbp->cnt;
+	if(delayed && chThdGetSelfX() == delayed)
+	{
+		chThdSleep(delay);
+		delayed = NULL;
+	}
+	else if(!delayed && chThdGetSelfX() && rng_uniform(0, 1) < 0.25f)
+		chThdSleepMilliseconds(rng_uniform(1, DELAY_MS));
+}
+
+static THD_WORKING_AREA(waPoster[POSTERS], 256);
+static THD_FUNCTION(Poster, arg){
+	while(posting)
+	{
+		chThdSleepMilliseconds(rng_uniform(0, POST_PERIOD_MS));
+		switchState(rng_next() & 1);
+	}
+}
+
+//a thread that ends SEARCH_BALL once, at start
+static THD_WORKING_AREA(waLate, 256);
+static THD_FUNCTION(Late, arg){
+	switchState(false);
+}
+
+//above the owner: it can fill the queue before the owner runs
+static THD_WORKING_AREA(waBurst, 256);
+static THD_FUNCTION(Burst, arg){
+	for(uint8_t i = 0 ; i < BURST ; i++)
+		switchState(true);
+}
+
+//ends the current state from the test and lets the state machine apply it
+static void end_state(bool success){
+	switchState(success);
+	sim_run_until(chVTGetSystemTime() + 1);
+}
+
+int main(void){
+
+	state_queue_stats_t before, stats;
+	uint32_t seed_posts = 0, seed_transitions = 0;
+	bool lost = false;
+	thread_t *late = NULL;
+
+	sim_post_hook = post_hook;
+
+	//posters at, below and above each other, all below the owner
+	for(uint32_t seed = 1 ; seed <= SEEDS ; seed++)
+	{
+		chSysInit();
+		sim_shuffle(seed);
+		rng_seed(seed);
+		state_machine_start();
+		before = getStateQueueStats();
+		seed_posts = posts;
+		seed_transitions = transitions;
+		posting = true;
+		for(uint8_t i = 0 ; i < POSTERS ; i++)
+			chThdCreateStatic(waPoster[i], sizeof(waPoster[i]), NORMALPRIO - 1 + i/2, Poster, NULL);
+		sim_run_until(RUN_MS);
+		//the posts under way are let through
+		posting = false;
+		sim_run_until(RUN_MS + POST_PERIOD_MS + DELAY_MS + 1);
+
+		stats = getStateQueueStats();
+		if(posts - seed_posts != (stats.applied - before.applied) + (stats.stale - before.stale) + (stats.dropped - before.dropped))
+			lost = true;
+		CHECK(stats.applied - before.applied == transitions - seed_transitions);
+		CHECK(stats.dropped == before.dropped);
+		CHECK(stats.inverted == before.inverted);
+	}
+	printf("queue: %u posts, %u transitions, %u stale over %u interleavings\n",
+		   posts, transitions, getStateQueueStats().stale, SEEDS);
+	CHECK(!lost);
+	CHECK(invalid == 0);
+	CHECK(transitions > 1000);
+	CHECK(getStateQueueStats().stale > 0);
+	//the owner applied each post before the next one: the latency is the owner's own
+	CHECK(queued_max == 0);
+
+	//A-B-A: a thread reads SEARCH_BALL, is delayed while the search fails, backs off and
+	//starts again, then posts. It ended the former search, not this one.
+	chSysInit();
+	sim_shuffle(0);
+	state_machine_start();
+	end_state(true);
+	end_state(true);
+	CHECK(getState() == SEARCH_BALL);
+	delay = MS2ST(50);
+	late = chThdCreateStatic(waLate, sizeof(waLate), NORMALPRIO, Late, NULL);
+	delayed = late;
+	sim_run_until(chVTGetSystemTime() + 1);
+	end_state(false);
+	CHECK(getState() == RETRY_BACKOFF);
+	end_state(true);
+	CHECK(getState() == SEARCH_BALL);
+	before = getStateQueueStats();
+	sim_run_until(chVTGetSystemTime() + 100);
+	CHECK(sim_thread_finished(late));
+	CHECK(getState() == SEARCH_BALL);
+	CHECK(getStateQueueStats().stale == before.stale + 1);
+
+	//a burst from above the owner fills the queue: the posts wait for room instead of being
+	//lost, and are counted as returned before being applied
+	before = getStateQueueStats();
+	queued_max = 0;
+	chThdCreateStatic(waBurst, sizeof(waBurst), STATE_OWNER_PRIO + 1, Burst, NULL);
+	sim_run_until(chVTGetSystemTime() + BURST*DELAY_MS + 1);
+	stats = getStateQueueStats();
+	CHECK(queued_max == STATE_QUEUE_SIZE);
+	CHECK(stats.dropped == before.dropped);
+	CHECK(stats.applied + stats.stale == before.applied + before.stale + BURST);
+	CHECK(stats.inverted == before.inverted + BURST);
+
+	return test_end("queue");
+}
@@ -0,0 +1,188 @@
+/*
+ * Retry policy of state_machine.c as scenarios: a field thread plays the search, lock, charge
+ * and verification with scripted outcomes and durations, the operator only whistles from
+ * MANUAL_MOVE. Checks where each scenario ends, the retries counted and the cycle time.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "test.h"
+
+#include <main.h>
+#include <state_machine.h>
+#include <led_sequencer.h>
+
+#define RETRY_MAX			2 //defaults of state_machine.c
+#define RETRY_BACKOFF_MS		1000
+
+//time each phase takes on the field [ms]
+#define SEARCH_MS			800
+#define LOCK_MS				300
+#define CHARGE_MS			400
+#define VERIFY_MS			200
+#define SHOT_MS				(SEARCH_MS + LOCK_MS + CHARGE_MS + VERIFY_MS)
+#define SCENARIO_MS			15000
+
+#define MAX_ATTEMPTS			8
+
+//Before user-050 the patterns were states of NBCYCLES_MAIN_LEDS + 1 ticks of the 200 ms main
+//loop: one after the tone, one after each failure and one after the shot held the robot.
+//Each also waited up to a tick to start, not counted here.
+#define SLEEP_MAIN_MS		200
+#define NBCYCLES_MAIN_LEDS	7
+#define LED_STATE_MS			((NBCYCLES_MAIN_LEDS + 1)*SLEEP_MAIN_MS)
+
+//where each attempt fails, NB_STATES for a successful shot
+static enum eputtState fails_in[MAX_ATTEMPTS];
+static uint8_t attempt = 0;
+static uint16_t tones = 0;
+
+void led_sequencer_play(enum ledPattern pattern){
+}
+
+void led_sequencer_set_steady(uint8_t leds){
+}
+
+static uint16_t phase_ms(enum eputtState state){
+	switch(state)
+	{
+		case SEARCH_BALL:	return SEARCH_MS;
+		case BALL_LOCKED:	return LOCK_MS;
+		case CHARGE_BALL:	return CHARGE_MS;
+		case SHOT_VERIFY:	return VERIFY_MS;
+		default:				return 0;
+	}
+}
+
+/* Field thread
+ * Ends each phase after its duration, failing it if the script says the attempt fails
+ * there. STARTUP ends right away, MANUAL_MOVE only on the operator tone.
+ */
+static THD_WORKING_AREA(waField, 256);
+static THD_FUNCTION(Field, arg){
+
+	enum eputtState state = NB_STATES;
+	systime_t entry = 0;
+
+	while(1)
+	{
+		if(getState() != state)
+		{
+			state = getState();
+			entry = chVTGetSystemTime();
+		}
+		if(state == STARTUP)
+			switchState(true);
+		else if(phase_ms(state) && chVTGetSystemTime() - entry >= MS2ST(phase_ms(state)))
+		{
+			switchState(fails_in[attempt] != state);
+			if(fails_in[attempt] == state || state == SHOT_VERIFY)
+				attempt++;
+		}
+		chThdSleepMilliseconds(1);
+	}
+}
+
+/* run_scenario(where each attempt fails, number of attempts, tones of the operator)
+ * From STARTUP, the operator whistles from MANUAL_MOVE, up to the number of tones given, and
+ * the robot runs on its own until the first shot or SCENARIO_MS. The state machine keeps its
+ * counters from a scenario to the next: the ones returned are those of the scenario.
+ */
+static shot_cycle_stats_t run_scenario(const enum eputtState *script, uint8_t n, uint16_t operator_tones){
+
+	shot_cycle_stats_t before = getShotCycleStats(), stats;
+	systime_t end = 0;
+
+	for(uint8_t i = 0 ; i < MAX_ATTEMPTS ; i++)
+		fails_in[i] = i < n ? script[i] : NB_STATES;
+	attempt = 0;
+	tones = 0;
+
+	chSysInit();
+	state_machine_start();
+	chThdCreateStatic(waField, sizeof(waField), NORMALPRIO, Field, NULL);
+	sim_run_until(10);
+
+	end = chVTGetSystemTime() + MS2ST(SCENARIO_MS);
+	while(chVTGetSystemTime() < end)
+	{
+		if(getState() == MANUAL_MOVE && tones < operator_tones)
+		{
+			tones++;
+			switchState(true);
+		}
+		//the first shot ends the scenario
+		if(getShotCycleStats().successes != before.successes)
+			break;
+		sim_run_until(chVTGetSystemTime() + 1);
+	}
+	stats = getShotCycleStats();
+	stats.attempts -= before.attempts;
+	stats.successes -= before.successes;
+	stats.retries -= before.retries;
+	return stats;
+}
+
+//cycle time of a successful scenario, and what the former LED states added to it
+static void report(const char *name, shot_cycle_stats_t stats){
+	printf("  %-18s %6u %6u\n", name, stats.cycle_time_ms,
+		   stats.cycle_time_ms + (2 + stats.retries)*LED_STATE_MS);
+}
+
+int main(void){
+
+	const enum eputtState lost_once[] = {SEARCH_BALL};
+	const enum eputtState missed_charge[] = {CHARGE_BALL};
+	const enum eputtState lock_then_verify[] = {BALL_LOCKED, SHOT_VERIFY};
+	const enum eputtState never[] = {SEARCH_BALL, SEARCH_BALL, SEARCH_BALL, SEARCH_BALL, SEARCH_BALL};
+	shot_cycle_stats_t stats;
+
+	//no failure: the shot is the sum of the phases
+	printf("retry: scenario, cycle time with the LED states running alongside, as states before [ms]\n");
+	stats = run_scenario(NULL, 0, 1);
+	report("no failure", stats);
+	CHECK(stats.successes == 1);
+	CHECK(stats.retries == 0);
+	CHECK_NEAR(stats.cycle_time_ms, SHOT_MS, 10);
+
+	//ball not found once: searched again after the back off, without the operator
+	stats = run_scenario(lost_once, 1, 1);
+	report("lost once", stats);
+	CHECK(stats.successes == 1);
+	CHECK(stats.retries == 1);
+	CHECK(stats.attempts == 2);
+	CHECK(tones == 1);
+	CHECK_NEAR(stats.cycle_time_ms, SEARCH_MS + RETRY_BACKOFF_MS + SHOT_MS, 10);
+	CHECK_NEAR(stats.time_to_shot_ms, SEARCH_MS + LOCK_MS + CHARGE_MS, 10);
+
+	//a charge that missed, the second one scores
+	stats = run_scenario(missed_charge, 1, 1);
+	report("missed charge", stats);
+	CHECK(stats.successes == 1);
+	CHECK(stats.retries == 1);
+	CHECK_NEAR(stats.cycle_time_ms, SEARCH_MS + LOCK_MS + CHARGE_MS + RETRY_BACKOFF_MS + SHOT_MS, 10);
+
+	//two failures in different phases: RETRY_MAX allows both
+	stats = run_scenario(lock_then_verify, 2, 1);
+	report("lock and verify", stats);
+	CHECK(stats.successes == 1);
+	CHECK(stats.retries == RETRY_MAX);
+	CHECK(tones == 1);
+
+	//never found: RETRY_MAX retries then the operator has the hand, nothing else moves
+	stats = run_scenario(never, 5, 1);
+	CHECK(stats.successes == 0);
+	CHECK(stats.retries == RETRY_MAX);
+	CHECK(stats.attempts == 1 + RETRY_MAX);
+	CHECK(getState() == MANUAL_MOVE);
+
+	//the operator whistles again: the retries start over from zero
+	stats = run_scenario(never, 5, 2);
+	CHECK(stats.successes == 1);
+	CHECK(stats.attempts == 1 + RETRY_MAX + 2 + 1);
+	CHECK(stats.retries == RETRY_MAX + 2);
+	CHECK(tones == 2);
+
+	return test_end("retry");
+}
@@ -0,0 +1,141 @@
+/*
+ * Shot verification of process_image.c on rendered sequences: the ball rolls away from the
+ * contact while the robot brakes behind it, over FOLLOW_THROUGH_MM. The camera only sees the
+ * distance between them, the wheel steps give back what the robot drove.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "render.h"
+#include "test.h"
+
+#include <main.h>
+#include <motors.h>
+#include <process_image.h>
+
+#define BALL_DIAMETER_MM		40 //as process_image.c
+#define FOLLOW_THROUGH_MM	25 //as eputt_regulator.c
+#define CONTACT_DIST_MM		60 //camera to the ball center at the contact
+#define ROLLING_DECEL		150 //[mm/s2] ball on the table
+#define VISIBLE_MIN_MM		(FOCAL_PXL*BALL_DIAMETER_MM/IMAGE_BUFFER_SIZE + 5) //closer, it fills the image
+#define DECISION_MS			1500
+
+typedef struct {
+	const char *name;
+	float ball_speed;		//[mm/s] at the contact
+	float robot_speed;		//[mm/s] at the contact, braking to a stop over FOLLOW_THROUGH_MM
+	bool hit;
+} shot_t;
+
+static const shot_t shots[] = {
+	{"firm", 450, 250, true},
+	{"firm, robot stopped", 450, 0, true},
+	{"slow, followed", 130, 120, true},
+	{"no contact", 0, 120, false},
+	{"stopped", 0, 0, false},
+};
+
+static enum eputtState state = CHARGE_BALL;
+static int decision = -1;
+static float ball_x = 0, ball_v = 0, robot_v = 0, robot_decel = 0;
+static float first_x = 0, first_t = 0, last_x = 0, last_t = 0;
+static bool first_seen = false;
+
+enum eputtState getState(void){
+	return state;
+}
+
+void switchState(bool success){
+	if(state == SHOT_VERIFY && decision < 0)
+		decision = success;
+}
+
+static float robot_x(void){
+	return STEPS_TO_MM((left_motor_get_pos() + right_motor_get_pos())/2.0f);
+}
+
+//the ball rolls, the robot brakes, each tick
+static void step(float dt){
+	ball_x += ball_v*dt;
+	ball_v = ball_v > ROLLING_DECEL*dt ? ball_v - ROLLING_DECEL*dt : 0;
+	robot_v = robot_v > robot_decel*dt ? robot_v - robot_decel*dt : 0;
+	left_motor_set_speed(MM_TO_STEPS(robot_v));
+	right_motor_set_speed(MM_TO_STEPS(robot_v));
+}
+
+//the ball straight ahead at its distance, the sightings of SHOT_VERIFY are kept
+static void render(uint8_t *band, uint16_t width, uint16_t lines, bool yuv){
+
+	float dist = ball_x - robot_x(), half = FOCAL_PXL*BALL_DIAMETER_MM/(2*dist);
+	scene_t scene = {.ball_left = width/2 - half, .ball_right = width/2 + half, .ball_lines = lines,
+					 .light = 1, .noise = 4};
+
+	render_band(band, width, lines, yuv, &scene);
+	if(state != SHOT_VERIFY || decision >= 0 || dist < VISIBLE_MIN_MM || dist > BALL_DIST_MAX_MM)
+		return;
+	last_x = ball_x;
+	last_t = ST2MS(chVTGetSystemTime())/1000.0f;
+	if(!first_seen)
+	{
+		first_x = last_x;
+		first_t = last_t;
+		first_seen = true;
+	}
+}
+
+static const hw_backend_t backend = {
+	.step = step,
+	.render = render,
+};
+
+int main(void){
+
+	float speed = 0;
+	systime_t contact = 0;
+	shot_stats_t before;
+
+	printf("shot: sequence, ball speed seen between the first and last sightings, measured [mm/s]\n");
+	for(uint8_t n = 0 ; n < sizeof(shots)/sizeof(shots[0]) ; n++)
+	{
+		chSysInit();
+		hw_init(&backend);
+		capture_process_img_start();
+
+		//the charge: the camera isn't used, then the contact
+		state = CHARGE_BALL;
+		decision = -1;
+		first_seen = false;
+		ball_x = CONTACT_DIST_MM;
+		ball_v = 0;
+		robot_v = 0;
+		sim_run_until(500);
+		before = getShotStats();
+
+		ball_x = robot_x() + CONTACT_DIST_MM;
+		ball_v = shots[n].ball_speed;
+		robot_v = shots[n].robot_speed;
+		robot_decel = robot_v*robot_v/(2*FOLLOW_THROUGH_MM);
+		state = SHOT_VERIFY;
+		contact = chVTGetSystemTime();
+		while(decision < 0 && chVTGetSystemTime() - contact < MS2ST(DECISION_MS))
+			sim_run_until(chVTGetSystemTime() + 1);
+
+		speed = first_seen && last_t > first_t ? (last_x - first_x)/(last_t - first_t) : 0;
+		printf("  %-20s %6.0f %6u\n", shots[n].name, speed, getShotStats().launch_speed);
+		CHECK(decision == shots[n].hit);
+		if(shots[n].hit)
+		{
+			CHECK(getShotStats().hits == before.hits + 1);
+			CHECK_NEAR(getShotStats().launch_speed, speed, 0.1f*speed + 10);
+		}
+		else
+		{
+			CHECK(getShotStats().misses == before.misses + 1);
+			CHECK(getShotStats().launch_speed == 0);
+		}
+	}
+
+	return test_end("shot");
+}
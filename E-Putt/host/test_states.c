@@ -0,0 +1,170 @@
+/*
+ * state_machine.c: every transition of every state, taken from the specification below and
+ * not from state_table, with the pattern played and the steady leds of the next state.
+ * Then the timed ends of RETRY_BACKOFF and SHOT_VERIFY and the transitions posted from a
+ * state already left.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "test.h"
+
+#include <main.h>
+#include <state_machine.h>
+#include <led_sequencer.h>
+
+#define RETRY_MAX			2 //defaults of state_machine.c
+#define RETRY_BACKOFF_MS		1000
+#define SHOT_VERIFY_TIMEOUT_MS	1500
+
+typedef struct {
+	enum eputtState next[2];		//on failure, on success
+	enum ledPattern pattern[2];
+	uint8_t leds;
+} spec_t;
+
+static const spec_t spec[NB_STATES] = {
+	[STARTUP]		= {{MANUAL_MOVE, MANUAL_MOVE}, {PATTERN_NONE, PATTERN_NONE}, SEQ_LED3 | SEQ_LED7},
+	[MANUAL_MOVE]	= {{SEARCH_BALL, SEARCH_BALL}, {PATTERN_MV_SB, PATTERN_MV_SB}, SEQ_BODY},
+	[SEARCH_BALL]	= {{RETRY_BACKOFF, BALL_LOCKED}, {PATTERN_BALL_NF, PATTERN_NONE}, SEQ_LED1},
+	[BALL_LOCKED]	= {{RETRY_BACKOFF, CHARGE_BALL}, {PATTERN_BALL_NF, PATTERN_NONE}, 0},
+	[CHARGE_BALL]	= {{RETRY_BACKOFF, SHOT_VERIFY}, {PATTERN_BALL_NF, PATTERN_NONE}, 0},
+	[SHOT_VERIFY]	= {{RETRY_BACKOFF, STARTUP}, {PATTERN_BALL_NF, PATTERN_SUCCESS}, 0},
+	[RETRY_BACKOFF]	= {{MANUAL_MOVE, SEARCH_BALL}, {PATTERN_NONE, PATTERN_NONE}, 0},
+};
+
+static const char *names[NB_STATES] = {"STARTUP", "MANUAL_MOVE", "SEARCH_BALL", "BALL_LOCKED",
+									   "CHARGE_BALL", "SHOT_VERIFY", "RETRY_BACKOFF"};
+
+static enum ledPattern played = PATTERN_NONE;
+static uint8_t steady = 0;
+static bool halted = false;
+
+void led_sequencer_play(enum ledPattern pattern){
+	played = pattern;
+}
+
+void led_sequencer_set_steady(uint8_t leds){
+	steady = leds;
+}
+
+static void on_halt(const char *reason){
+	halted = true;
+}
+
+//ends the current state and lets the state machine apply it
+static void end_state(bool success){
+	played = NB_PATTERNS;
+	switchState(success);
+	sim_run_until(chVTGetSystemTime() + 1);
+}
+
+/* go_to(state)
+ * Shortest path in the specification from the current state, walked with end_state().
+ */
+static bool go_to(enum eputtState target){
+
+	enum eputtState from[NB_STATES], queue[NB_STATES], path[NB_STATES], s = 0;
+	bool outcome[NB_STATES], visited[NB_STATES] = {false};
+	uint8_t head = 0, tail = 0, n = 0;
+
+	queue[tail++] = getState();
+	visited[getState()] = true;
+	while(head < tail && !visited[target])
+	{
+		s = queue[head++];
+		for(uint8_t o = 0 ; o < 2 ; o++)
+			if(!visited[spec[s].next[o]])
+			{
+				visited[spec[s].next[o]] = true;
+				from[spec[s].next[o]] = s;
+				outcome[spec[s].next[o]] = o;
+				queue[tail++] = spec[s].next[o];
+			}
+	}
+	if(!visited[target])
+		return false;
+	for(s = target ; s != getState() ; s = from[s])
+		path[n++] = s;
+	while(n)
+	{
+		n--;
+		end_state(outcome[path[n]]);
+		if(getState() != path[n])
+			return false;
+	}
+	return true;
+}
+
+int main(void){
+
+	state_queue_stats_t queue = {0};
+	uint8_t retried = 0;
+
+	chSysInit();
+	sim_halt_hook = on_halt;
+	state_machine_start();
+	sim_run_until(1);
+
+	//the table passed its check and the machine starts in STARTUP
+	CHECK(!halted);
+	CHECK(getState() == STARTUP);
+	CHECK(steady == spec[STARTUP].leds);
+
+	//every state, ended both ways
+	for(enum eputtState s = 0 ; s < NB_STATES ; s++)
+		for(uint8_t o = 0 ; o < 2 ; o++)
+		{
+			CHECK(go_to(s));
+			end_state(o);
+			if(getState() != spec[s].next[o])
+				fprintf(stderr, "%s %s: %s\n", names[s], o ? "success" : "failure", names[getState()]);
+			CHECK(getState() == spec[s].next[o]);
+			CHECK(played == spec[s].pattern[o]);
+			CHECK(steady == spec[getState()].leds);
+		}
+	CHECK(getStateQueueStats().stale == 0);
+	CHECK(getStateQueueStats().dropped == 0);
+
+	//RETRY_BACKOFF ends on its own: RETRY_MAX searches again, then the operator has the hand
+	CHECK(go_to(MANUAL_MOVE));
+	end_state(true);
+	for(retried = 0 ; retried <= RETRY_MAX ; retried++)
+	{
+		CHECK(getState() == SEARCH_BALL);
+		end_state(false);
+		CHECK(getState() == RETRY_BACKOFF);
+		sim_run_until(chVTGetSystemTime() + RETRY_BACKOFF_MS - 2);
+		CHECK(getState() == RETRY_BACKOFF);
+		sim_run_until(chVTGetSystemTime() + 2);
+		if(getState() != SEARCH_BALL)
+			break;
+	}
+	CHECK(retried == RETRY_MAX);
+	CHECK(getState() == MANUAL_MOVE);
+	CHECK(getShotCycleStats().retries >= RETRY_MAX);
+
+	//no decision from the camera: the shot is missed
+	CHECK(go_to(SHOT_VERIFY));
+	played = NB_PATTERNS;
+	sim_run_until(chVTGetSystemTime() + SHOT_VERIFY_TIMEOUT_MS - 2);
+	CHECK(getState() == SHOT_VERIFY);
+	sim_run_until(chVTGetSystemTime() + 2);
+	CHECK(getState() == RETRY_BACKOFF);
+	CHECK(played == PATTERN_BALL_NF);
+
+	//two threads ending the same state: the second transition is discarded, not applied
+	//to the next state
+	CHECK(go_to(SEARCH_BALL));
+	queue = getStateQueueStats();
+	switchState(true);
+	switchState(true);
+	sim_run_until(chVTGetSystemTime() + 1);
+	CHECK(getState() == BALL_LOCKED);
+	CHECK(getStateQueueStats().applied == queue.applied + 1);
+	CHECK(getStateQueueStats().stale == queue.stale + 1);
+	CHECK(!halted);
+
+	return test_end("states");
+}
@@ -0,0 +1,87 @@
+/*
+ * tof.c: median of the VL53L0X measures, invalid until filled and restarted on a mode
+ * change, time of the samples.
+ */
+#include <stdio.h>
+
+#include "ch.h"
+#include "kernel.h"
+#include "hw.h"
+#include "test.h"
+
+#include <main.h>
+#include <tof.h>
+
+#define RUN_MAX_MS			1000
+
+//raw measures returned in turn by the sensor
+static const uint16_t raws[] = {300, 310, 900, 305, HW_TOF_NO_TARGET, 320, 315, 110, 120, 130};
+static uint8_t reads = 0;
+static systime_t read_time = 0;
+static uint32_t seq = 0;
+static enum eputtState state = SEARCH_BALL;
+
+enum eputtState getState(void){
+	return state;
+}
+
+static uint16_t tof_mm(void){
+	read_time = chVTGetSystemTime();
+	return reads < sizeof(raws)/sizeof(raws[0]) ? raws[reads++] : HW_TOF_NO_TARGET;
+}
+
+static const hw_backend_t backend = {
+	.tof_mm = tof_mm,
+};
+
+static bool new_sample(void){
+	return tof_get_sample().seq != seq;
+}
+
+//runs until the next sample, checks it is stamped at its read
+static tof_sample_t next_sample(void){
+
+	tof_sample_t sample;
+
+	CHECK(sim_run_until_done(chVTGetSystemTime() + RUN_MAX_MS, new_sample));
+	sample = tof_get_sample();
+	seq = sample.seq;
+	CHECK(sample.time == read_time);
+	return sample;
+}
+
+int main(void){
+
+	tof_sample_t sample;
+
+	chSysInit();
+	hw_init(&backend);
+	tof_start();
+
+	//not valid until the median has its three measures
+	CHECK(!next_sample().valid);
+	CHECK(!next_sample().valid);
+	sample = next_sample();
+	CHECK(sample.valid && sample.dist_mm == 310);
+	//the outlier is removed
+	sample = next_sample();
+	CHECK(sample.valid && sample.dist_mm == 310);
+	//no target: invalid, and not in the median
+	CHECK(!next_sample().valid);
+	sample = next_sample();
+	CHECK(sample.valid && sample.dist_mm == 320);
+	CHECK(sample.seq == 6);
+
+	//fast mode: the measure already started ends in the previous mode,
+	//then the measures of the previous mode are forgotten
+	state = BALL_LOCKED;
+	sample = next_sample();
+	CHECK(sample.valid && sample.dist_mm == 315);
+	CHECK(!next_sample().valid);
+	CHECK(!next_sample().valid);
+	sample = next_sample();
+	CHECK(sample.valid && sample.dist_mm == 120);
+	CHECK(reads == 10);
+
+	return test_end("tof");
+}
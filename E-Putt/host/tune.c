@@ -0,0 +1,423 @@
+/*
+ * Offline tuning of the bearing loop from regulator traces (REGULATOR_TRACE), from the robot
+ * or from the simulator. A plant is fitted on the frames where the ball is seen during the
+ * search: lag of the wheels on the command, pixels per step of rotation, camera delay and
+ * noise. The bearing PID and the alignment detector of eputt_regulator.c are then run on this
+ * plant for a grid of parameters, split between as many processes as there are cores, and
+ * ranked by settling time, overshoot and frames to declare the alignment.
+ *	tune [-j jobs] trace.csv...
+ * Prints the plant, the best sets and the UDEFS of the best one.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "render.h"
+
+#include <main.h>
+#include <motors.h>
+#include <pid.h>
+#include <align_detect.h>
+#include <regulator_tuning.h>
+
+#define MAX_FRAMES			100000
+#define MAX_DELAY			2 //frames between the rotation and the image that shows it
+#define MAX_GAP				1.5f //periods between two frames of the fit, lost frames or a pause
+#define HORIZON				60 //frames of each step response
+#define SETTLE_PXL			10 //accuracy wanted, whatever the threshold of the set
+#define SEEDS				8
+#define SHOWN				10
+#define WRONG_PENALTY_MS		2000 //an alignment declared out of the threshold costs a retry
+#define OVERSHOOT_MS			10 //cost of 1% of overshoot
+
+#define SEARCH_SPEED			(MOTOR_SPEED_LIMIT/2) //MANUAL_TURN_SPEED
+
+typedef struct {
+	unsigned time;
+	unsigned state;
+	unsigned seen;
+	int error;			//ball position from the center [pxl]
+	int command;		//rotation asked after this frame, (left - right)/2 [steps/s]
+	int left;			//steps
+	int right;
+} frame_t;
+
+typedef struct {
+	float lag;			//wheel rotation speed, per frame: w = lag*w + (1 - lag)*command
+	float gain;			//pixels per step of rotation
+	uint8_t delay;		//frames
+	float noise;		//[pxl]
+	float period_ms;
+	uint32_t samples;
+} plant_t;
+
+typedef struct {
+	float kp;
+	float ki;
+	float leak;
+	uint8_t threshold;
+	uint8_t window;
+	uint8_t min_samples;
+	float confidence;
+} params_t;
+
+typedef struct {
+	float settle_ms;		//mean, until the error stays in the threshold
+	float overshoot;		//mean, [%] of the initial error
+	float align_ms;			//mean, until the alignment is declared
+	float wrong;			//share of alignments declared with the error out of SETTLE_PXL
+	float cost;
+} score_t;
+
+typedef struct {
+	int16_t error;		//[pxl]
+	int16_t speed;		//rotation of the wheels [steps/s]
+} start_t;
+
+static const float grid_kp[] = {0.4f, 0.6f, 0.8f, 1.0f, 1.2f, 1.5f, 2.0f};
+static const float grid_ki[] = {0, 0.05f, 0.1f, 0.15f, 0.25f};
+static const float grid_leak[] = {0.8f, 0.9f, 0.93f, 0.97f};
+static const uint8_t grid_threshold[] = {6, 8, 10, 12, 14};
+static const uint8_t grid_window[][2] = {{4, 2}, {6, 3}, {8, 4}, {12, 6}};
+static const float grid_confidence[] = {1.5f, 2.0f, 3.0f};
+//ball found at rest, then entering the image while the search turns towards it
+static const start_t starts[] = {{-250, 0}, {-120, 0}, {-40, 0}, {40, 0}, {120, 0}, {250, 0},
+								 {-250, -SEARCH_SPEED}, {250, SEARCH_SPEED}};
+
+#define COUNT(a)				(sizeof(a)/sizeof(a[0]))
+#define GRID_SIZE			(COUNT(grid_kp)*COUNT(grid_ki)*COUNT(grid_leak)*COUNT(grid_threshold)\
+							 *COUNT(grid_window)*COUNT(grid_confidence))
+
+static frame_t frames[MAX_FRAMES];
+
+/* load(trace, frames already loaded)
+ * time,state,seen,pos,left speed,right speed,left steps,right steps, one line per fresh frame.
+ */
+static uint32_t load(const char *path, uint32_t n){
+
+	FILE *file = fopen(path, "r");
+	char line[128];
+	frame_t f;
+	int pos = 0, left_speed = 0, right_speed = 0;
+
+	if(!file)
+	{
+		perror(path);
+		return n;
+	}
+	while(n < MAX_FRAMES && fgets(line, sizeof(line), file))
+	{
+		if(sscanf(line, "%u,%u,%u,%d,%d,%d,%d,%d", &f.time, &f.state, &f.seen, &pos,
+				  &left_speed, &right_speed, &f.left, &f.right) != 8)
+			continue;
+		f.error = pos - IMAGE_BUFFER_SIZE/2;
+		f.command = (left_speed - right_speed)/2;
+		frames[n++] = f;
+	}
+	fclose(file);
+	return n;
+}
+
+//rotation speed of the wheels between two frames, as the command [steps/s]
+static float rotation(const frame_t *from, const frame_t *to){
+	return ((to->left - from->left) - (to->right - from->right))/2.0f*1000/(to->time - from->time);
+}
+
+static float period_ms = 0;
+
+//frames k - MAX_DELAY - 1 to k + 1 of a same search, one period apart, the ball seen on k and k + 1
+static bool usable(uint32_t k, uint32_t n){
+	if(k < MAX_DELAY + 1 || k + 1 >= n || !frames[k].seen || !frames[k + 1].seen)
+		return false;
+	for(uint32_t i = k - MAX_DELAY - 1 ; i <= k + 1 ; i++)
+		if(frames[i].state != SEARCH_BALL
+		   || (i > k - MAX_DELAY - 1 && frames[i].time - frames[i - 1].time > MAX_GAP*period_ms))
+			return false;
+	return true;
+}
+
+static int compare_float(const void *a, const void *b){
+	return (*(const float *)a > *(const float *)b) - (*(const float *)a < *(const float *)b);
+}
+
+/* fit(frames)
+ * Least squares of the lag on the wheel speeds, then of the gain for each camera delay,
+ * the delay with the smallest residual is kept.
+ */
+static bool fit(uint32_t n, plant_t *plant){
+
+	double num = 0, den = 0, residual = 0, best = INFINITY;
+	static float periods[MAX_FRAMES];
+	float w0 = 0, w1 = 0, u = 0, motion = 0;
+	uint32_t m = 0, p = 0;
+
+	//frame period: median interval, before the lost frames can be told apart
+	for(uint32_t k = 1 ; k < n ; k++)
+		if(frames[k].state == frames[k - 1].state && frames[k].time > frames[k - 1].time)
+			periods[p++] = frames[k].time - frames[k - 1].time;
+	if(p == 0)
+		return false;
+	qsort(periods, p, sizeof(periods[0]), compare_float);
+	period_ms = plant->period_ms = periods[p/2];
+
+	for(uint32_t k = 0 ; k < n ; k++)
+		if(usable(k, n))
+		{
+			w0 = rotation(&frames[k - 1], &frames[k]);
+			w1 = rotation(&frames[k], &frames[k + 1]);
+			u = frames[k].command;
+			num += (w1 - u)*(w0 - u);
+			den += (w0 - u)*(w0 - u);
+			m++;
+		}
+	if(m < 20 || den == 0)
+		return false;
+	plant->lag = fminf(fmaxf(num/den, 0), 0.95f);
+	plant->samples = m;
+
+	for(uint8_t d = 0 ; d <= MAX_DELAY ; d++)
+	{
+		num = den = residual = 0;
+		m = 0;
+		for(uint32_t k = 0 ; k < n ; k++)
+			if(usable(k, n))
+			{
+				//steps turned during the interval shown by frame k + 1
+				motion = rotation(&frames[k - d], &frames[k + 1 - d])*(frames[k + 1 - d].time - frames[k - d].time)/1000;
+				num += -(frames[k + 1].error - frames[k].error)*motion;
+				den += motion*motion;
+			}
+		if(den == 0)
+			continue;
+		for(uint32_t k = 0 ; k < n ; k++)
+			if(usable(k, n))
+			{
+				motion = rotation(&frames[k - d], &frames[k + 1 - d])*(frames[k + 1 - d].time - frames[k - d].time)/1000;
+				residual += pow(frames[k + 1].error - frames[k].error + num/den*motion, 2);
+				m++;
+			}
+		if(residual < best)
+		{
+			best = residual;
+			plant->gain = num/den;
+			plant->delay = d;
+			//the difference of two frames has twice the variance of one
+			plant->noise = sqrt(residual/m/2);
+		}
+	}
+	return best < INFINITY && plant->gain > 0;
+}
+
+static params_t grid(uint32_t index){
+
+	params_t p;
+
+	p.confidence = grid_confidence[index % COUNT(grid_confidence)];
+	index /= COUNT(grid_confidence);
+	p.window = grid_window[index % COUNT(grid_window)][0];
+	p.min_samples = grid_window[index % COUNT(grid_window)][1];
+	index /= COUNT(grid_window);
+	p.threshold = grid_threshold[index % COUNT(grid_threshold)];
+	index /= COUNT(grid_threshold);
+	p.leak = grid_leak[index % COUNT(grid_leak)];
+	index /= COUNT(grid_leak);
+	p.ki = grid_ki[index % COUNT(grid_ki)];
+	index /= COUNT(grid_ki);
+	p.kp = grid_kp[index % COUNT(grid_kp)];
+	return p;
+}
+
+/* evaluate(plant, parameters)
+ * Step responses from each initial error, on SEEDS noise draws. The regulator turns from
+ * each frame as eputt_regulator.c, the alignment is declared as there but the response runs
+ * on to HORIZON to see it settle.
+ */
+static score_t evaluate(const plant_t *plant, const params_t *p){
+
+	pid_config_t pid_cfg = {
+		.kp = p->kp,
+		.ki = p->ki,
+		.leak = p->leak,
+		.int_max = p->ki > 0 ? MOTOR_SPEED_LIMIT/(5*p->ki) : 0,
+		.deadband = p->threshold,
+		.out_max = MOTOR_SPEED_LIMIT,
+	};
+	align_config_t align_cfg = {p->window, p->min_samples, p->threshold, p->confidence};
+	pid_ctrl_t pid;
+	align_window_t align;
+	score_t score = {0};
+	float truth = 0, w = 0, motion[MAX_DELAY + 1], over = 0, command = 0;
+	uint16_t settled = 0, aligned = 0, runs = 0, wrong = 0;
+	int16_t measure = 0;
+
+	for(uint8_t e = 0 ; e < COUNT(starts) ; e++)
+		for(uint8_t s = 0 ; s < SEEDS ; s++)
+		{
+			rng_seed(1 + s*COUNT(starts) + e);
+			pid_init(&pid, &pid_cfg);
+			align_init(&align, &align_cfg);
+			truth = starts[e].error;
+			w = starts[e].speed;
+			over = 0;
+			settled = aligned = 0;
+			for(uint8_t d = 0 ; d <= MAX_DELAY ; d++)
+				motion[d] = w*plant->period_ms/1000;
+			for(uint16_t k = 1 ; k <= HORIZON ; k++)
+			{
+				measure = lroundf(truth + rng_gauss(plant->noise));
+				command = pid_update(&pid, measure, 0);
+				if(!aligned)
+				{
+					align_add(&align, measure);
+					if(align_converged(&align))
+					{
+						aligned = k;
+						wrong += fabsf(truth) > SETTLE_PXL;
+					}
+				}
+				//the wheels follow the command, the camera shows the motion delay frames later
+				w = plant->lag*w + (1 - plant->lag)*command;
+				memmove(&motion[1], &motion[0], MAX_DELAY*sizeof(motion[0]));
+				motion[0] = w*plant->period_ms/1000;
+				truth -= plant->gain*motion[plant->delay];
+
+				if(fabsf(truth) > SETTLE_PXL)
+					settled = k;
+				if(-truth*starts[e].error > over*abs(starts[e].error))
+					over = -truth*starts[e].error/abs(starts[e].error);
+			}
+			score.settle_ms += settled*plant->period_ms;
+			score.overshoot += 100*over/abs(starts[e].error);
+			score.align_ms += (aligned ? aligned : HORIZON)*plant->period_ms;
+			runs++;
+		}
+	score.settle_ms /= runs;
+	score.overshoot /= runs;
+	score.align_ms /= runs;
+	score.wrong = (float)wrong/runs;
+	score.cost = score.settle_ms + OVERSHOOT_MS*score.overshoot + score.align_ms + WRONG_PENALTY_MS*score.wrong;
+	return score;
+}
+
+/* sweep(plant, scores, jobs)
+ * Each process takes every jobs-th set of the grid and writes its scores on its own pipe.
+ */
+static bool sweep(const plant_t *plant, score_t *scores, uint16_t jobs){
+
+	int fd[jobs][2];
+	pid_t pid[jobs];
+	score_t score;
+	bool ok = true;
+
+	for(uint16_t j = 0 ; j < jobs ; j++)
+	{
+		if(pipe(fd[j]) < 0)
+			return false;
+		pid[j] = fork();
+		if(pid[j] == 0)
+		{
+			close(fd[j][0]);
+			for(uint32_t i = j ; i < GRID_SIZE ; i += jobs)
+			{
+				params_t p = grid(i);
+				score = evaluate(plant, &p);
+				if(write(fd[j][1], &score, sizeof(score)) != sizeof(score))
+					_exit(1);
+			}
+			_exit(0);
+		}
+		close(fd[j][1]);
+	}
+	for(uint16_t j = 0 ; j < jobs ; j++)
+	{
+		for(uint32_t i = j ; i < GRID_SIZE ; i += jobs)
+			if(read(fd[j][0], &scores[i], sizeof(score)) != sizeof(score))
+				ok = false;
+		close(fd[j][0]);
+		waitpid(pid[j], NULL, 0);
+	}
+	return ok;
+}
+
+static void print_set(const char *label, const params_t *p, const score_t *s){
+	printf("  %-8s %4.2f %4.2f %4.2f %3u %2u/%-2u %3.1f %7.0f %6.1f %7.0f %5.1f\n", label, p->kp, p->ki,
+		   p->leak, p->threshold, p->window, p->min_samples, p->confidence,
+		   s->settle_ms, s->overshoot, s->align_ms, 100*s->wrong);
+}
+
+int main(int argc, char **argv){
+
+	static score_t scores[GRID_SIZE];
+	static uint32_t order[GRID_SIZE];
+	const params_t defaults = {KP, KI, KI_PRIOR, ROTATION_THRESHOLD, ALIGN_WINDOW, ALIGN_MIN_SAMPLES, ALIGN_CONFIDENCE};
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	plant_t plant;
+	score_t reference;
+	params_t best;
+	uint32_t n = 0, ranked = 0;
+	char label[16];
+	int opt = 0;
+
+	while((opt = getopt(argc, argv, "j:")) != -1)
+	{
+		if(opt == 'j')
+			jobs = atoi(optarg);
+		else
+			return 2;
+	}
+	if(optind >= argc || jobs < 1)
+	{
+		fprintf(stderr, "usage: %s [-j jobs] trace.csv...\n", argv[0]);
+		return 2;
+	}
+	for(int i = optind ; i < argc ; i++)
+		n = load(argv[i], n);
+	if(!fit(n, &plant))
+	{
+		fprintf(stderr, "tune: not enough frames with the ball seen during a search (%u frames)\n", n);
+		return 1;
+	}
+	printf("tune: plant fitted on %u frames: lag %.2f, %.2f pxl/step, delay %u frames, noise %.1f pxl, frame %.0f ms\n",
+		   plant.samples, plant.lag, plant.gain, plant.delay, plant.noise, plant.period_ms);
+
+	if(!sweep(&plant, scores, jobs))
+	{
+		fprintf(stderr, "tune: a worker failed\n");
+		return 1;
+	}
+	//without integral the leak changes nothing: a single row of each
+	for(uint32_t i = 0 ; i < GRID_SIZE ; i++)
+		if(grid(i).ki > 0 || grid(i).leak == grid_leak[0])
+			order[ranked++] = i;
+	for(uint32_t i = 1 ; i < ranked ; i++)
+		for(uint32_t j = i ; j > 0 && scores[order[j]].cost < scores[order[j - 1]].cost ; j--)
+		{
+			uint32_t t = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = t;
+		}
+
+	printf("tune: %u sets on %ld jobs, ranked by settling in %u pxl + %u ms per %% of overshoot + alignment + %u ms per wrong alignment\n",
+		   ranked, jobs, SETTLE_PXL, OVERSHOOT_MS, WRONG_PENALTY_MS);
+	printf("  %-8s %4s %4s %4s %3s %5s %3s %7s %6s %7s %5s\n", "", "KP", "KI", "PRIOR", "THR",
+		   "WIN", "CONF", "settle", "over%", "align", "wrong%");
+	reference = evaluate(&plant, &defaults);
+	print_set("defaults", &defaults, &reference);
+	for(uint8_t i = 0 ; i < SHOWN && i < ranked ; i++)
+	{
+		params_t p = grid(order[i]);
+		snprintf(label, sizeof(label), "#%u", i + 1);
+		print_set(label, &p, &scores[order[i]]);
+	}
+
+	best = grid(order[0]);
+	printf("UDEFS += -DKP=%.2ff -DKI=%.2ff", best.kp, best.ki);
+	if(best.ki > 0)
+		printf(" -DKI_PRIOR=%.2ff", best.leak);
+	printf(" -DROTATION_THRESHOLD=%u -DALIGN_WINDOW=%u -DALIGN_MIN_SAMPLES=%u -DALIGN_CONFIDENCE=%.1ff\n",
+		   best.threshold, best.window, best.min_samples, best.confidence);
+	return 0;
+}
@@ -0,0 +1,134 @@
+#include "ch.h"
+#include "hal.h"
+#include <stdlib.h>
+
+#include <sensors/proximity.h>
+#include <msgbus/messagebus.h>
+
+#include <main.h>
+#include <ir_proximity.h>
+#include <process_image.h>
+
+//IR sensors of the e-puck2 used to look ahead
+#define IR_FRONT_RIGHT		0 //17 deg
+#define IR_RIGHT				1 //49 deg
+#define IR_LEFT				6 //-49 deg
+#define IR_FRONT_LEFT		7 //-17 deg
+
+//Avoidance parameters, calibrated proximity values (higher is closer)
+#define PROX_FREE			100 //nothing in front under this value
+#define PROX_STOP			1000 //obstacle nearly touching, no forward motion
+#define AVOID_GAIN			0.8f //steering [steps/s] per unit of left/right difference
+//The front sensors see the ball, not an obstacle, only when it is ahead and within their range
+#define BALL_AHEAD_PXL		100 //from the middle of the image, about 8 deg
+#define BALL_PROX_RANGE_MM	150 //farther, what the front sensors see is something else
+
+//Contact with the ball during the charge, in the blind zone of the camera and TOF
+#define PROX_CONTACT			2000 //front reading when the ball touches the robot
+#define PROX_RELEASE			600 //the ball has left after the contact
+
+static bool ball_contact = false, ball_released = false;
+
+static int16_t clamp_speed(int16_t value, int16_t max){
+	if(value > max)
+		return max;
+	else if(value < -max)
+		return -max;
+	return value;
+}
+
+static int front_prox(const proximity_msg_t *prox){
+	int right = prox->delta[IR_FRONT_RIGHT] - prox->initValue[IR_FRONT_RIGHT];
+	int left = prox->delta[IR_FRONT_LEFT] - prox->initValue[IR_FRONT_LEFT];
+	return (right > left) ? right : left;
+}
+
+/*THREAD: ContactDetect*/
+static THD_WORKING_AREA(waContactDetect, 256);
+static THD_FUNCTION(ContactDetect, arg){
+
+    chRegSetThreadName(__FUNCTION__);
+    (void)arg;
+
+    messagebus_topic_t *prox_topic = messagebus_find_topic_blocking(&bus, "/proximity");
+    proximity_msg_t prox_values;
+
+    while(1)
+    {
+		//every sample of the proximity thread is looked at, not only the regulator ticks
+		messagebus_topic_wait(prox_topic, &prox_values, sizeof(prox_values));
+
+		if(getState() != CHARGE_BALL)
+		{
+			ball_contact = ball_released = false;
+			continue;
+		}
+
+		if(!ball_contact && front_prox(&prox_values) > PROX_CONTACT)
+			ball_contact = true;
+		else if(ball_contact && !ball_released && front_prox(&prox_values) < PROX_RELEASE)
+			ball_released = true;
+    }
+}
+
+void ir_proximity_start(void){
+	proximity_start();
+	calibrate_ir();
+	chThdCreateStatic(waContactDetect, sizeof(waContactDetect), NORMALPRIO, ContactDetect, NULL);
+}
+
+bool ir_ball_contact(){
+	return ball_contact;
+}
+
+bool ir_ball_released(){
+	return ball_released;
+}
+
+//the camera sees the ball right in front and close: it is what the front sensors read
+static bool ball_ahead(void){
+	return ballSeenLast() && abs((int16_t)getBallPos() - IMAGE_BUFFER_SIZE/2) <= BALL_AHEAD_PXL
+			&& getBallDistMm() <= BALL_PROX_RANGE_MM;
+}
+
+//front sensor reading for the avoidance: the ball ahead is the target, not an obstacle
+static int avoid_prox(uint8_t sensor){
+	if((sensor == IR_FRONT_RIGHT || sensor == IR_FRONT_LEFT) && ball_ahead())
+		return 0;
+	return get_calibrated_prox(sensor);
+}
+
+/* obstacle_avoidance(left speed, right speed)
+ * Reactive layer for the manual drive: the forward part of the command is reduced as the
+ * free space shrinks and a rotation away from the closest side is blended in.
+ * Rotations on place are left untouched, they can't hit anything.
+ * The front sensors are ignored while the camera sees the ball close ahead, so it can be driven
+ * into. A ball elsewhere in the image doesn't hide a wall in front.
+ */
+void obstacle_avoidance(int16_t *left, int16_t *right){
+
+	int16_t forward = (*left + *right)/2;
+	int16_t turn = (*left - *right)/2;
+	int16_t front = 0, left_side = 0, right_side = 0;
+	float free_space = 1;
+
+	if(forward <= 0)
+		return;
+
+	right_side = avoid_prox(IR_FRONT_RIGHT) + avoid_prox(IR_RIGHT)/2;
+	left_side = avoid_prox(IR_FRONT_LEFT) + avoid_prox(IR_LEFT)/2;
+	front = (avoid_prox(IR_FRONT_RIGHT) > avoid_prox(IR_FRONT_LEFT)) ?
+			avoid_prox(IR_FRONT_RIGHT) : avoid_prox(IR_FRONT_LEFT);
+
+	if(front > PROX_STOP)
+		free_space = 0;
+	else if(front > PROX_FREE)
+		free_space = 1 - (float)(front - PROX_FREE)/(PROX_STOP - PROX_FREE);
+
+	//positive turn goes right, away from an obstacle on the left
+	turn = clamp_speed(turn + AVOID_GAIN*(left_side - right_side), forward);
+	forward *= free_space;
+
+	*left = forward + turn;
+	*right = forward - turn;
+}
@@ -0,0 +1,12 @@
+#ifndef IR_PROXIMITY_H
+#define IR_PROXIMITY_H
+
+//start and calibrate the IR proximity sensors, nothing must be close to the robot
+void ir_proximity_start(void);
+//scales the forward speed by the free space ahead and steers away from obstacles
+void obstacle_avoidance(int16_t *left, int16_t *right);
+//during CHARGE_BALL: the ball touched the front of the robot, then left it
+bool ir_ball_contact(void);
+bool ir_ball_released(void);
+
+#endif /* IR_PROXIMITY_H */
@@ -0,0 +1,101 @@
+#include "ch.h"
+#include "hal.h"
+
+#include <leds.h>
+
+#include <led_sequencer.h>
+
+#define PATTERN_MAX_FRAMES	8
+#define PATTERN_STEP_MS		200
+
+enum {LED_OFF = 0, LED_ON};
+
+//An animation: each frame gives the leds lit among the ones it drives, the others stay steady.
+//Frames are absolute, so a pattern always ends in a known state whatever its length.
+typedef struct {
+	uint16_t period_ms;
+	uint8_t leds;
+	uint8_t nb_frames;
+	uint8_t frames[PATTERN_MAX_FRAMES];
+} led_pattern_t;
+
+static const led_pattern_t patterns[] = {
+	[PATTERN_NONE]		= {0, 0, 0, {0}},
+	//turning leds: the operator asked for a search
+	[PATTERN_MV_SB]		= {PATTERN_STEP_MS, SEQ_LED1 | SEQ_LED3 | SEQ_LED5 | SEQ_LED7, 8,
+							{SEQ_LED1, SEQ_LED1 | SEQ_LED3, SEQ_LED1 | SEQ_LED3 | SEQ_LED5,
+							SEQ_LED1 | SEQ_LED3 | SEQ_LED5 | SEQ_LED7, SEQ_LED3 | SEQ_LED5 | SEQ_LED7,
+							SEQ_LED5 | SEQ_LED7, SEQ_LED7, 0}},
+	//ball not found or shot missed
+	[PATTERN_BALL_NF]	= {PATTERN_STEP_MS, SEQ_FRONT, 8,
+							{SEQ_FRONT, 0, SEQ_FRONT, 0, SEQ_FRONT, 0, SEQ_FRONT, 0}},
+	//successful shot
+	[PATTERN_SUCCESS]	= {PATTERN_STEP_MS, SEQ_BODY, 8,
+							{SEQ_BODY, 0, SEQ_BODY, 0, SEQ_BODY, 0, SEQ_BODY, 0}},
+};
+_Static_assert(sizeof(patterns)/sizeof(patterns[0]) == NB_PATTERNS, "patterns must describe every ledPattern");
+
+static virtual_timer_t seq_timer;
+static const led_pattern_t *playing = NULL;
+static uint8_t frame = 0;
+static uint8_t steady = 0;
+
+//called locked, the leds are only GPIOs
+static void leds_apply(void){
+
+	uint8_t lit = steady;
+
+	if(playing)
+		lit = (steady & ~playing->leds) | (playing->frames[frame] & playing->leds);
+
+	set_led(LED1, (lit & SEQ_LED1) ? LED_ON : LED_OFF);
+	set_led(LED3, (lit & SEQ_LED3) ? LED_ON : LED_OFF);
+	set_led(LED5, (lit & SEQ_LED5) ? LED_ON : LED_OFF);
+	set_led(LED7, (lit & SEQ_LED7) ? LED_ON : LED_OFF);
+	set_front_led((lit & SEQ_FRONT) ? LED_ON : LED_OFF);
+	set_body_led((lit & SEQ_BODY) ? LED_ON : LED_OFF);
+}
+
+//virtual timer callback, ISR context
+static void seq_step(void *arg){
+
+	(void)arg;
+
+	chSysLockFromISR();
+	if(playing)
+	{
+		frame++;
+		if(frame >= playing->nb_frames)
+			playing = NULL;
+		else
+			chVTSetI(&seq_timer, MS2ST(playing->period_ms), seq_step, NULL);
+	}
+	leds_apply();
+	chSysUnlockFromISR();
+}
+
+void led_sequencer_start(void){
+	chVTObjectInit(&seq_timer);
+}
+
+void led_sequencer_set_steady(uint8_t leds){
+	chSysLock();
+	steady = leds;
+	leds_apply();
+	chSysUnlock();
+}
+
+void led_sequencer_play(enum ledPattern pattern){
+
+	if(pattern == PATTERN_NONE || pattern >= NB_PATTERNS)
+		return;
+
+	chSysLock();
+	playing = &patterns[pattern];
+	frame = 0;
+	if(chVTIsArmedI(&seq_timer))
+		chVTResetI(&seq_timer);
+	chVTSetI(&seq_timer, MS2ST(playing->period_ms), seq_step, NULL);
+	leds_apply();
+	chSysUnlock();
+}
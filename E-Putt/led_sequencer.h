@@ -0,0 +1,21 @@
+#ifndef LED_SEQUENCER_H
+#define LED_SEQUENCER_H
+
+//Leds of the e-puck2 as bits of a frame
+#define SEQ_LED1			(1 << 0)
+#define SEQ_LED3			(1 << 1)
+#define SEQ_LED5			(1 << 2)
+#define SEQ_LED7			(1 << 3)
+#define SEQ_FRONT		(1 << 4)
+#define SEQ_BODY			(1 << 5)
+
+//Animations, described in led_sequencer.c
+enum ledPattern{PATTERN_NONE = 0, PATTERN_MV_SB, PATTERN_BALL_NF, PATTERN_SUCCESS, NB_PATTERNS};
+
+void led_sequencer_start(void);
+//leds lit when no pattern drives them, set by the state machine
+void led_sequencer_set_steady(uint8_t leds);
+//plays a pattern over the steady leds on a virtual timer, replaces the one playing, doesn't block
+void led_sequencer_play(enum ledPattern pattern);
+
+#endif /* LED_SEQUENCER_H */
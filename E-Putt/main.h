@@ -12,16 +12,44 @@ extern "C" {
 //These defines are used by multiples source files.
 #define TIME_MS_PIDREG 			10 //execution period of the controller.
 #define IMAGE_BUFFER_SIZE		640 //total width of camera, pixels
+#define FOCAL_PXL				690 //empirical, converts a pixel offset from the center to an angle [rad]
+
+//Wheels of the e-puck2, used to convert the motor steps
+#define NSTEP_ONE_TURN			1000 //number of steps for 1 turn of the motor
+#define WHEEL_PERIMETER_MM		130
+#define WHEEL_DISTANCE_MM		53 //distance between the wheels
+#define MM_TO_STEPS(mm)			((mm)*NSTEP_ONE_TURN/WHEEL_PERIMETER_MM)
+#define STEPS_TO_MM(steps)		((steps)*WHEEL_PERIMETER_MM/NSTEP_ONE_TURN)
+
+//States available, the LED animations run alongside them
+enum eputtState{STARTUP = 0, MANUAL_MOVE, SEARCH_BALL, BALL_LOCKED, CHARGE_BALL, SHOT_VERIFY,
+				RETRY_BACKOFF, NB_STATES};
+
+//durations and outcome of the shots, measured by the state machine
+typedef struct {
+	uint16_t attempts;			//entries in SEARCH_BALL
+	uint16_t successes;			//shots confirmed by SHOT_VERIFY
+	uint16_t retries;			//searches started again without the operator
+	uint16_t time_to_lock_ms;	//last SEARCH_BALL to BALL_LOCKED
+	uint16_t time_to_shot_ms;	//last SEARCH_BALL to the end of the charge
+	uint16_t cycle_time_ms;		//operator tone to the end of the last successful shot, retries included
+} shot_cycle_stats_t;
+
+//transitions posted to the state machine thread
+typedef struct {
+	uint32_t applied;
+	uint32_t stale;		//posted from a state that was already left, discarded
+	uint32_t dropped;	//queue full, lost
+	uint32_t inverted;	//posted from a thread not below the owner, returned before being applied
+} state_queue_stats_t;
 
-//States available. Keep LED states at the end of the list. LEDSTATE is used to identify them (IDs are above)
-enum eputtState{STARTUP = 0, MANUAL_MOVE, SEARCH_BALL, BALL_LOCKED, CHARGE_BALL,
-				LEDSTATE, LED_MV_SB, LED_BALL_NF, LED_SUCCESS};
-
-void setState(enum eputtState nouvEtat);
 enum eputtState getState(void);
+//posts the end of the current state, callable from any thread
 void switchState(bool success);
-bool led_handler(void);
-void stateLed_update(void);
+//broadcast on each state change
+event_source_t* getStateEvent(void);
+shot_cycle_stats_t getShotCycleStats(void);
+state_queue_stats_t getStateQueueStats(void);
 
 /** Robot wide IPC bus. */
 extern messagebus_t bus;
@@ -0,0 +1,223 @@
+#include "ch.h"
+#include "hal.h"
+#include <math.h>
+
+#include <main.h>
+#include <motion_profile.h>
+#include <motors.h>
+#include <motor_arbiter.h>
+#include <ir_proximity.h>
+#include <odometry.h>
+#include <pid.h>
+
+#define MOTOR_UPDATE_MS		TIME_MS_PIDREG
+#define MS_PER_S				1000.0f
+
+//Profile limits, empirical: above them the wheels slip on the table
+#define ACCEL_MAX			6000.0f //[steps/s^2], full speed in about 0.2s
+#define JERK_MAX				60000.0f //[steps/s^3]
+//[steps/s^2] soft start of the charge, the charge speed is reached in about 45mm. Matching
+//the acceleration to the distance would mean crawling toward any ball farther than that
+#define ACCEL_CHARGE			1500.0f
+
+//Heading hold of the charge on the gyro yaw, output in differential steps/s
+#ifndef HOLD_KP
+#define HOLD_KP				3000.0f //[steps/s per rad], 0.01rad asks about the mismatch of 1% at full speed
+#endif
+#ifndef HOLD_KI
+#define HOLD_KI				200.0f //per motor update
+#endif
+#define HOLD_MAX				150 //[steps/s], a larger drift is not a wheel mismatch anymore
+//0: the charge runs open loop on the wheel steps, as before the gyro, to compare them
+#ifndef HEADING_HOLD
+#define HEADING_HOLD			1
+#endif
+//0: the wheels take the speeds of the charge at once, as before the profiles, to compare them
+#ifndef CHARGE_PROFILE
+#define CHARGE_PROFILE		1
+#endif
+
+static const pid_config_t hold_pid_cfg = {
+	.kp = HOLD_KP,
+	.ki = HOLD_KI,
+	.kd = 0,
+	.leak = 1.0f,
+	.int_max = HOLD_MAX/HOLD_KI,
+	.deadband = 0,
+	.out_max = HOLD_MAX,
+	.slew_max = 0,
+};
+static pid_ctrl_t hold_pid = {.cfg = &hold_pid_cfg};
+
+static const profile_config_t wheel_profile_cfg = {
+	.accel_max = ACCEL_MAX,
+	.jerk_max = JERK_MAX,
+};
+
+static profile_t left_profile, right_profile;
+
+void profile_init(profile_t *profile, const profile_config_t *cfg){
+	profile->cfg = cfg;
+	profile->accel_limit = cfg->accel_max;
+	profile->speed = 0;
+	profile->accel = 0;
+}
+
+/* profile_update(profile, target speed, time step)
+ * S-curve: the acceleration changes at most by jerk_max and is bounded by accel_limit.
+ * Near the target, the acceleration is reduced so that it reaches zero with the speed.
+ */
+float profile_update(profile_t *profile, float target, float dt){
+
+	float dv = target - profile->speed;
+	float accel_wanted = 0, daccel = 0;
+
+	//largest acceleration that can still be brought back to zero before the target
+	accel_wanted = sqrtf(2*profile->cfg->jerk_max*fabsf(dv));
+	if(accel_wanted > profile->accel_limit)
+		accel_wanted = profile->accel_limit;
+	if(dv < 0)
+		accel_wanted = -accel_wanted;
+
+	daccel = accel_wanted - profile->accel;
+	if(daccel > profile->cfg->jerk_max*dt)
+		daccel = profile->cfg->jerk_max*dt;
+	else if(daccel < -profile->cfg->jerk_max*dt)
+		daccel = -profile->cfg->jerk_max*dt;
+	profile->accel += daccel;
+
+	profile->speed += profile->accel*dt;
+
+	//target reached or passed
+	if((dv >= 0 && profile->speed >= target) || (dv <= 0 && profile->speed <= target))
+	{
+		profile->speed = target;
+		profile->accel = 0;
+	}
+	return profile->speed;
+}
+
+/* heading_hold(left target, right target)
+ * The charge is commanded straight, but the wheels never match perfectly.
+ * The heading is locked at the first straight command of the charge, then the
+ * yaw drift is corrected on the wheel speeds. The charge starts in BALL_LOCKED, where
+ * the camera can still turn the robot: the heading to hold follows its turns, and only
+ * the integral, the wheel mismatch, is corrected then.
+ * Returns the differential speed to add to the left wheel, and take from the right one,
+ * past the profiles: on the soft ramp of the charge both wheels are held to the same
+ * acceleration, a correction of the targets would only show once they reach them.
+ */
+static int16_t heading_hold(int16_t left, int16_t right){
+
+	static bool charging = false;
+	static float heading = 0;
+
+	if(!HEADING_HOLD || (getState() != BALL_LOCKED && getState() != CHARGE_BALL))
+	{
+		charging = false;
+		return 0;
+	}
+	if(left == 0 && right == 0)
+		return 0;
+
+	if(!charging)
+		pid_reset(&hold_pid);
+	if(!charging || left != right)
+		heading = odometry_get_yaw();
+	charging = true;
+
+	//turned counterclockwise: the left wheel has to go faster
+	return pid_update(&hold_pid, odometry_get_yaw() - heading, 0);
+}
+
+/* write_corrected(left speed, right speed, correction)
+ * The correction is added past the profiles, near the charge speed a wheel can go over
+ * MOTOR_SPEED_LIMIT. The driver would clamp that wheel alone and lose part of the correction:
+ * the excess is taken from both wheels instead, the difference between them is kept.
+ */
+static void write_corrected(float left, float right, int16_t correction){
+
+	float excess = 0;
+
+	left += correction;
+	right -= correction;
+	excess = fmaxf(fabsf(left), fabsf(right)) - MOTOR_SPEED_LIMIT;
+	if(excess > 0)
+	{
+		if(fabsf(left) > fabsf(right))
+			excess = copysignf(excess, left);
+		else
+			excess = copysignf(excess, right);
+		left -= excess;
+		right -= excess;
+	}
+	motor_arbiter_write(left, right);
+}
+
+/*THREAD: MotorUpdate*/
+static THD_WORKING_AREA(waMotorUpdate, 256);
+static THD_FUNCTION(MotorUpdate, arg){
+
+    chRegSetThreadName(__FUNCTION__);
+    (void)arg;
+
+    systime_t time;
+    const float dt = MOTOR_UPDATE_MS/MS_PER_S;
+    int16_t left_target = 0, right_target = 0, correction = 0;
+
+    while(1)
+    {
+		time = chVTGetSystemTime();
+
+		//one command per cycle, whatever the number of behaviors asking
+		//the manual drive goes through the obstacle avoidance at the motor rate
+		correction = 0;
+		if(motor_arbiter_resolve(&left_target, &right_target) == MOTOR_REMOTE)
+			obstacle_avoidance(&left_target, &right_target);
+		else
+			correction = heading_hold(left_target, right_target);
+
+		//step commands of the charge, the profiles only follow them
+		if(!CHARGE_PROFILE && (getState() == BALL_LOCKED || getState() == CHARGE_BALL))
+		{
+			left_profile.speed = left_target;
+			right_profile.speed = right_target;
+			left_profile.accel = right_profile.accel = 0;
+		}
+
+		//back to full acceleration once the charge is over
+		if(left_target == 0 && right_target == 0)
+			left_profile.accel_limit = right_profile.accel_limit = ACCEL_MAX;
+
+		write_corrected(profile_update(&left_profile, left_target, dt),
+						profile_update(&right_profile, right_target, dt), correction);
+
+		chThdSleepUntilWindowed(time, time + MS2ST(MOTOR_UPDATE_MS));
+    }
+}
+
+void motion_start(void){
+	profile_init(&left_profile, &wheel_profile_cfg);
+	profile_init(&right_profile, &wheel_profile_cfg);
+	chThdCreateStatic(waMotorUpdate, sizeof(waMotorUpdate), NORMALPRIO, MotorUpdate, NULL);
+}
+
+/* motion_soft_charge()
+ * Softer starts mean less slip and a straighter charge, until the wheels stop.
+ */
+void motion_soft_charge(void){
+	left_profile.accel_limit = right_profile.accel_limit = ACCEL_CHARGE;
+}
+
+/* motion_braking_mm(speed [steps/s])
+ * v^2/(2*a) plus the time to ramp the deceleration with the jerk limit
+ */
+uint16_t motion_braking_mm(uint16_t speed){
+	float ramp_time = ACCEL_MAX/JERK_MAX;
+	return STEPS_TO_MM((float)speed*speed/(2*ACCEL_MAX) + speed*ramp_time);
+}
+
+uint16_t motion_get_speed(void){
+	float speed = (left_profile.speed + right_profile.speed)/2;
+	return speed > 0 ? speed : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef MOTION_PROFILE_H
+#define MOTION_PROFILE_H
+
+//Limits of a speed profile, speeds in steps/s
+typedef struct {
+	float accel_max;	//[steps/s^2]
+	float jerk_max;		//[steps/s^3]
+} profile_config_t;
+
+typedef struct {
+	const profile_config_t *cfg;
+	float accel_limit;	//can be lowered under cfg->accel_max, e.g. for a charge
+	float speed;
+	float accel;
+} profile_t;
+
+void profile_init(profile_t *profile, const profile_config_t *cfg);
+//moves the speed toward target during dt [s], returns the new speed
+float profile_update(profile_t *profile, float target, float dt);
+
+//start the thread applying the profiles to the command chosen by the motor arbiter
+void motion_start(void);
+//lowers the acceleration for the charge, until the wheels are stopped
+void motion_soft_charge(void);
+//distance [mm] needed to stop from the given speed [steps/s]
+uint16_t motion_braking_mm(uint16_t speed);
+//forward speed currently applied by the profiles [steps/s], 0 when turning in place
+uint16_t motion_get_speed(void);
+
+#endif /* MOTION_PROFILE_H */
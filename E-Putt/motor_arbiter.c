@@ -0,0 +1,119 @@
+#include "ch.h"
+#include "hal.h"
+
+#include <main.h>
+#include <motors.h>
+#include <motor_arbiter.h>
+
+#define REQUEST_TIMEOUT_MS	200 //a behavior that stops asking loses the motors
+
+typedef struct {
+	int16_t left;
+	int16_t right;
+	systime_t time;
+	systime_t origin;
+	bool valid;
+	bool timed;		//has an origin not yet written
+} motor_request_t;
+
+static motor_request_t requests[NB_MOTOR_SOURCES];
+static motor_arbiter_stats_t stats = {.source = -1};
+static bool first_write = true;
+static bool origin_pending = false; //the command resolved in this cycle has an origin
+static systime_t origin = 0;
+
+static void request(enum motorSource source, int16_t left, int16_t right, bool timed, systime_t from){
+	//requests come from several threads (regulator, audio)
+	chSysLock();
+	requests[source].left = left;
+	requests[source].right = right;
+	requests[source].time = chVTGetSystemTimeX();
+	requests[source].origin = from;
+	requests[source].valid = true;
+	requests[source].timed = timed;
+	chSysUnlock();
+}
+
+void motor_request(enum motorSource source, int16_t left, int16_t right){
+	request(source, left, right, false, 0);
+}
+
+void motor_request_from(enum motorSource source, int16_t left, int16_t right, systime_t from){
+	request(source, left, right, true, from);
+}
+
+void motor_release(enum motorSource source){
+	chSysLock();
+	requests[source].valid = false;
+	chSysUnlock();
+}
+
+/* motor_arbiter_resolve(left target, right target)
+ * The highest priority valid request wins, the others are counted as overridden.
+ * Without any valid request, the motors are stopped.
+ */
+int8_t motor_arbiter_resolve(int16_t *left, int16_t *right){
+
+	int8_t winner = -1;
+
+	*left = 0;
+	*right = 0;
+	stats.cycles++;
+
+	chSysLock();
+	for(int8_t i = NB_MOTOR_SOURCES-1 ; i >= 0 ; i--)
+	{
+		if(requests[i].valid && chVTGetSystemTimeX() - requests[i].time > MS2ST(REQUEST_TIMEOUT_MS))
+			requests[i].valid = false;
+
+		if(!requests[i].valid)
+			continue;
+
+		if(winner < 0)
+		{
+			winner = i;
+			*left = requests[i].left;
+			*right = requests[i].right;
+			origin_pending = requests[i].timed;
+			origin = requests[i].origin;
+			requests[i].timed = false;
+		}
+		else if(requests[i].left != *left || requests[i].right != *right)
+			stats.overrides++;
+	}
+	chSysUnlock();
+
+	stats.source = winner;
+	return winner;
+}
+
+/* motor_arbiter_write(left speed, right speed)
+ * Also measures the time from the origin of a new command to the wheels: the command waits
+ * for the next motor cycle, whatever wakes the thread that requested it.
+ */
+void motor_arbiter_write(int16_t left, int16_t right){
+	if(origin_pending)
+	{
+		origin_pending = false;
+		stats.latency_last = ST2MS(chVTGetSystemTime() - origin);
+		if(stats.latency_last > stats.latency_max)
+			stats.latency_max = stats.latency_last;
+	}
+	if(first_write || left != stats.left)
+	{
+		left_motor_set_speed(left);
+		stats.writes++;
+	}
+	if(first_write || right != stats.right)
+	{
+		right_motor_set_speed(right);
+		stats.writes++;
+	}
+	first_write = false;
+	stats.left = left;
+	stats.right = right;
+}
+
+motor_arbiter_stats_t motor_arbiter_get_stats(){
+	return stats;
+}
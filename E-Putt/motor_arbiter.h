@@ -0,0 +1,32 @@
+#ifndef MOTOR_ARBITER_H
+#define MOTOR_ARBITER_H
+
+//Behaviors allowed to drive the motors, by increasing priority
+enum motorSource{MOTOR_REMOTE = 0, MOTOR_REGULATOR, MOTOR_CHARGE, NB_MOTOR_SOURCES};
+
+//command applied during the last motor cycle
+typedef struct {
+	int16_t left;
+	int16_t right;
+	int8_t source;		//winning source, -1 if nobody asked (motors stopped)
+	uint32_t overrides;	//requests hidden by a higher priority one
+	uint32_t writes;	//driver calls actually made
+	uint32_t cycles;	//motor cycles run, one wake-up of the motor thread each
+	uint16_t latency_last;	//[ms] from the origin of a request to the cycle writing it
+	uint16_t latency_max;	//[ms]
+} motor_arbiter_stats_t;
+
+//speeds requested by a behavior [steps/s], valid until replaced, released or expired
+void motor_request(enum motorSource source, int16_t left, int16_t right);
+//same, computed from data taken at origin (e.g. the end of a frame): the latency is measured
+void motor_request_from(enum motorSource source, int16_t left, int16_t right, systime_t origin);
+void motor_release(enum motorSource source);
+
+//called once per motor cycle: target speeds of the highest priority valid request,
+//returns its source, -1 if nobody asks
+int8_t motor_arbiter_resolve(int16_t *left, int16_t *right);
+//writes the wheels, skipping the ones whose speed didn't change
+void motor_arbiter_write(int16_t left, int16_t right);
+motor_arbiter_stats_t motor_arbiter_get_stats(void);
+
+#endif /* MOTOR_ARBITER_H */
@@ -0,0 +1,52 @@
+#include "ch.h"
+#include "hal.h"
+
+#include <sensors/imu.h>
+#include <msgbus/messagebus.h>
+
+#include <main.h>
+#include <motors.h>
+#include <odometry.h>
+
+static float yaw = 0;
+
+/*THREAD: YawIntegrate*/
+static THD_WORKING_AREA(waYawIntegrate, 256);
+static THD_FUNCTION(YawIntegrate, arg){
+
+    chRegSetThreadName(__FUNCTION__);
+    (void)arg;
+
+    messagebus_topic_t *imu_topic = messagebus_find_topic_blocking(&bus, "/imu");
+    imu_msg_t imu_values;
+    systime_t time, time_prev;
+
+    messagebus_topic_wait(imu_topic, &imu_values, sizeof(imu_values));
+    time_prev = chVTGetSystemTime();
+
+    while(1)
+    {
+		//every sample of the IMU thread is integrated, with its real period
+		messagebus_topic_wait(imu_topic, &imu_values, sizeof(imu_values));
+		time = chVTGetSystemTime();
+
+		//in ticks: ST2MS() would round each period up to the next millisecond
+		yaw += imu_values.gyro_rate[Z_AXIS]*(float)(time - time_prev)/CH_CFG_ST_FREQUENCY;
+		time_prev = time;
+    }
+}
+
+void odometry_start(void){
+	imu_start();
+	calibrate_gyro();
+	chThdCreateStatic(waYawIntegrate, sizeof(waYawIntegrate), NORMALPRIO+1, YawIntegrate, NULL);
+}
+
+float odometry_get_heading(void){
+	int32_t diff_steps = right_motor_get_pos() - left_motor_get_pos();
+	return (float)diff_steps*WHEEL_PERIMETER_MM/(NSTEP_ONE_TURN*WHEEL_DISTANCE_MM);
+}
+
+float odometry_get_yaw(void){
+	return yaw;
+}
@@ -0,0 +1,12 @@
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+//heading [rad] from the motor steps since power on, counterclockwise positive, not wrapped
+float odometry_get_heading(void);
+//heading [rad] integrated from the gyro since power on, same convention, doesn't slip with the wheels
+float odometry_get_yaw(void);
+
+//starts the IMU, calibrates the gyro (robot must stay still) and integrates the yaw
+void odometry_start(void);
+
+#endif /* ODOMETRY_H */
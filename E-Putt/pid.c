@@ -0,0 +1,62 @@
+#include <math.h>
+
+#include <pid.h>
+
+static float clamp(float value, float max){
+	if(value > max)
+		return max;
+	else if(value < -max)
+		return -max;
+	return value;
+}
+
+void pid_init(pid_ctrl_t *pid, const pid_config_t *cfg){
+	pid->cfg = cfg;
+	pid_reset(pid);
+}
+
+void pid_reset(pid_ctrl_t *pid){
+	pid->integral = 0;
+	pid->prev_error = 0;
+	pid->output = 0;
+}
+
+/* pid_update(controller, error, feedforward)
+ * Discrete PID with a leaky integral kept in float, so small errors are not truncated away.
+ * Anti-windup by conditional integration: the integral isn't increased when the output
+ * is saturated and the error would push it further in the same direction.
+ * Inside the deadband only the feedforward is output and the integral is frozen, as the
+ * previous PI regulator did.
+ */
+float pid_update(pid_ctrl_t *pid, float error, float feedforward){
+
+	const pid_config_t *cfg = pid->cfg;
+	float integral = 0, derivative = 0, output = 0;
+
+	if(fabsf(error) < cfg->deadband)
+		output = feedforward;
+	else
+	{
+		integral = clamp(pid->integral*cfg->leak + error, cfg->int_max);
+		derivative = error - pid->prev_error;
+
+		output = cfg->kp*error + cfg->ki*integral + cfg->kd*derivative + feedforward;
+
+		if(fabsf(output) > cfg->out_max && output*error > 0)
+		{
+			//saturated: only let the integral leak
+			integral = clamp(pid->integral*cfg->leak, cfg->int_max);
+			output = cfg->kp*error + cfg->ki*integral + cfg->kd*derivative + feedforward;
+		}
+		pid->integral = integral;
+	}
+	pid->prev_error = error;
+
+	output = clamp(output, cfg->out_max);
+
+	if(cfg->slew_max > 0)
+		output = pid->output + clamp(output - pid->output, cfg->slew_max);
+
+	pid->output = output;
+	return output;
+}
@@ -0,0 +1,28 @@
+#ifndef PID_H
+#define PID_H
+
+//Gains and limits of a controller, meant to be declared const so they are fixed at compile time
+typedef struct {
+	float kp;
+	float ki;
+	float kd;
+	float leak;			//integral multiplied by it at each update, 1 means no forgetting
+	float int_max;		//clamp of the integral, in error units
+	float deadband;		//errors smaller than this are ignored
+	float out_max;		//saturation of the output
+	float slew_max;		//maximum change of the output per update, 0 to disable
+} pid_config_t;
+
+typedef struct {
+	const pid_config_t *cfg;
+	float integral;
+	float prev_error;
+	float output;
+} pid_ctrl_t;
+
+void pid_init(pid_ctrl_t *pid, const pid_config_t *cfg);
+void pid_reset(pid_ctrl_t *pid);
+//returns the command for the given error, feedforward is added before saturation
+float pid_update(pid_ctrl_t *pid, float error, float feedforward);
+
+#endif /* PID_H */
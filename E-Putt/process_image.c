@@ -2,17 +2,211 @@
 #include "hal.h"
 
 #include <camera/po8030.h>
+#include <motors.h>
 
 #include <main.h>
 #include <process_image.h>
 
-#define CAPTURE_LINE_NB			200
-#define NB_CAPTURED_LINES		2
+#define CAPTURE_LINE_NB			200 //center line of the captured band
+#ifndef NB_CAPTURED_LINES
+#define NB_CAPTURED_LINES		8 //height of the band, from 4 to 16 lines (16 bits lanes of reduce_band())
+#endif
+#define FIRST_CAPTURED_LINE		(CAPTURE_LINE_NB - NB_CAPTURED_LINES/2)
 #define WIDTH_SLOPE				6
 #define MIN_OBJ_WIDTH			70 //40 previously but not good because noise/distance
+#define MIN_GOAL_WIDTH			12 //the goal marker is usually further away than the ball
+#define GOAL_MARGIN				8 //the goal marker must be this far below the mean of its profile
+
+//Capture formats. In YUV422 the ball is detected on the V (red difference) chroma,
+//which contrasts better with the background. RGB565 stays the default until the YUV
+//thresholds are validated on the robot, YUV422 is selected with UDEFS.
+#define CAPTURE_FORMAT_RGB565	0
+#define CAPTURE_FORMAT_YUV422	1
+#ifndef CAPTURE_FORMAT
+#define CAPTURE_FORMAT			CAPTURE_FORMAT_RGB565
+#endif
+
+#define RED_MASK_2PXL			0x00F800F8 //red bits of two RGB565 pixels read as one word
+#define BLUE_MASK_2PXL			0x001F001F //blue bits of two RGB565 pixels, once shifted by BLUE_SHIFT
+#define BLUE_SHIFT				8
+#define BLUE_SCALE				3 //brings the 5 bits of blue to the scale of red
+#define LUMA_MASK_2PXL			0x00FF00FF //Y of two YCbYCr pixels read as one word
+#define CHROMA_SHIFT				8 //brings Cb and Cr of a YCbYCr word in the LUMA_MASK_2PXL lanes
+#define LANE_MASK				0xFFFF
+#define LANE_SHIFT				16
+#define CHROMA_MAX				255
+
+//Exposure control during ball tracking, driven by the brightness of the band
+#if CAPTURE_FORMAT == CAPTURE_FORMAT_YUV422
+#define AE_TARGET_MEAN			110 //wanted mean of the luma (0 to 255)
+#else
+#define AE_TARGET_MEAN			120 //wanted mean of the red profile (0 to 248)
+#endif
+#define AE_TOLERANCE				16
+#define AE_PERIOD_FRAMES			3 //let the sensor apply a setting before the next correction
+#define TARGET_FPS				15 //frame rate to hold while tracking the ball
+#define LINE_TIME_US				127 //duration of one sensor line, empirical
+#define EXPOSURE_INIT			300 //[lines]
+#define EXPOSURE_MIN				16 //[lines]
+#define EXPOSURE_MAX				(1000000/(TARGET_FPS*LINE_TIME_US)) //longer would lower the frame rate
+#define GAIN_UNITY				64 //gains are expressed in 1/64
+#define GAIN_MAX					255
+#define GAIN_MARGIN_SHIFT		4 //threshold margin added per 16/64 of extra gain
+#define RED_GAIN_DEFAULT			0x5E //po8030 default digital gains
+#define GREEN_GAIN_DEFAULT		0x40
+#define BLUE_GAIN_DEFAULT		0x5D
+#define FPS_WINDOW_MS			1000
+//0: the sensor AE runs while tracking too, as before the control, to compare them
+#ifndef EXPOSURE_CONTROL
+#define EXPOSURE_CONTROL			1
+#endif
+
+//Frame acquisition deadlines. While tracking, the exposure is capped to hold TARGET_FPS.
+//Outside tracking the sensor AE can lengthen the frames a lot in a dim room.
+#define FRAME_PERIOD_MS			(1000/TARGET_FPS)
+#define FRAME_LATE_MS			(3*FRAME_PERIOD_MS/2) //frame arrived but later than expected
+#define FRAME_TIMEOUT_MS			(3*FRAME_PERIOD_MS) //frame considered lost, the capture is re-armed
+#define FRAME_TIMEOUT_AE_MS		1000 //same outside tracking, above the longest AE frame
+#define MAX_RESULT_AGE_MS		(2*FRAME_PERIOD_MS) //older detections are not trusted anymore
+
+//Shot verification: the ball must be seen moving away after the impact
+#define BALL_DIAMETER_MM			40
+#if BALL_DIST_MAX_MM != FOCAL_PXL*BALL_DIAMETER_MM/MIN_OBJ_WIDTH
+#error "BALL_DIST_MAX_MM doesn't match the smallest detected width"
+#endif
+#define SHOT_VERIFY_FRAMES		8 //analysed frames before deciding
+#define SHOT_MIN_DISP_MM			40 //displacement needed to call it a hit
+#define MS_PER_S					1000
+
+//Execution time of extract_ball_pos(), measured with the DWT cycle counter.
+//It shares NORMALPRIO with the regulator, so it must stay well under its period.
+#define EXTRACT_BUDGET_CYCLES	(STM32_SYSCLK/2000) //0.5ms
+#ifndef EXTRACT_HALT_ON_OVERRUN
+#define EXTRACT_HALT_ON_OVERRUN	1 //the startup self-test stops the system over budget, 0 only counts
+#endif
+
+//Synthetic lines timed at startup: the slowest paths of extract_ball_pos()
+#define WCET_HIGH				200
+#define WCET_LOW					20
+#define WCET_COMB_HALF			(WIDTH_SLOPE + 2) //narrow dips, each one found then rescanned
+enum wcetLine{WCET_FLAT = 0, WCET_COMB, WCET_NO_END, WCET_LAST_BALL, WCET_NB_LINES};
 
 static uint16_t ball_position = IMAGE_BUFFER_SIZE/2;	//middle
+static uint16_t ball_begin = 0, ball_end = 0;
+static uint8_t ball_height = 0;
+static uint8_t line_mean = 0;
+static uint8_t band_brightness = 0;
+static uint8_t threshold_margin = 0; //raised with the gain to ignore the amplified noise
 static bool seenLast = false;
+static uint16_t goal_position = IMAGE_BUFFER_SIZE/2;
+static bool goalSeenLast = false;
+
+static uint16_t exposure = EXPOSURE_INIT;
+static uint16_t gain = GAIN_UNITY;
+static bool ae_active = false;
+
+static uint8_t capture_fps = 0, detection_rate = 0;
+
+static uint32_t frame_seq = 0; //sequence number of the last frame
+static systime_t frame_time = 0; //arrival time of the last frame
+static frame_stats_t frame_stats = {0};
+static extract_timing_t extract_timing = {0};
+static shot_stats_t shot_stats = {0};
+
+static EVENTSOURCE_DECL(frame_event); //broadcast after each frame
+static BSEMAPHORE_DECL(frame_ready, true); //end of capture, forwarded by FrameWait
+
+#if CAPTURE_FORMAT == CAPTURE_FORMAT_YUV422
+/* reduce_band(YCbYCr band, output profile, output goal profile)
+ * Averages the V chroma of the NB_CAPTURED_LINES lines column by column. A word holds
+ * two pixels sharing one Cb and one Cr, both summed at once in two 16 bits lanes.
+ * The profile is inverted (CHROMA_MAX - V) so that, as in RGB565, the ball is a dip.
+ * The U chroma comes for free in the other lane: the yellow goal marker is a dip in it.
+ * The luma is summed the same way to give the brightness of the band to the exposure control.
+ */
+static void reduce_band(const uint8_t *band, uint8_t *profile, uint8_t *goal_profile){
+
+	const uint32_t *pxl_pairs = (const uint32_t*)band;
+	uint32_t chroma = 0, luma = 0, luma_sum = 0;
+	uint8_t v = 0;
+
+	for(uint16_t i = 0 ; i < IMAGE_BUFFER_SIZE/2 ; i++)
+	{
+		chroma = luma = 0;
+		for(uint8_t line = 0 ; line < NB_CAPTURED_LINES ; line++)
+		{
+			chroma += (pxl_pairs[line*(IMAGE_BUFFER_SIZE/2) + i] >> CHROMA_SHIFT) & LUMA_MASK_2PXL;
+			luma += pxl_pairs[line*(IMAGE_BUFFER_SIZE/2) + i] & LUMA_MASK_2PXL;
+		}
+
+		v = (chroma >> LANE_SHIFT)/NB_CAPTURED_LINES;
+		profile[2*i] = profile[2*i+1] = CHROMA_MAX - v;
+		goal_profile[2*i] = goal_profile[2*i+1] = (chroma & LANE_MASK)/NB_CAPTURED_LINES;
+		luma_sum += (luma & LANE_MASK) + (luma >> LANE_SHIFT);
+	}
+	band_brightness = luma_sum/(IMAGE_BUFFER_SIZE*NB_CAPTURED_LINES);
+}
+
+//value of one pixel of the band, in the same scale as the profile
+static uint8_t band_pixel(const uint8_t *band, uint8_t line, uint16_t i){
+	return CHROMA_MAX - band[2*(line*IMAGE_BUFFER_SIZE + (i & ~1)) + 3];
+}
+#else
+/* reduce_band(RGB565 band, output profile, output goal profile)
+ * Averages the red channel of the NB_CAPTURED_LINES lines column by column.
+ * Two pixels are read as one 32 bits word and their red bytes are summed in two 16 bits lanes
+ * at once, so the cost of an extra line is a load, a mask and an add per pair of pixels.
+ * The blue channel is reduced the same way: the yellow goal marker is a dip in it.
+ */
+static void reduce_band(const uint8_t *band, uint8_t *profile, uint8_t *goal_profile){
+
+	const uint32_t *pxl_pairs = (const uint32_t*)band;
+	uint32_t lanes = 0, blue = 0, sum = 0;
+
+	for(uint16_t i = 0 ; i < IMAGE_BUFFER_SIZE/2 ; i++)
+	{
+		lanes = blue = 0;
+		for(uint8_t line = 0 ; line < NB_CAPTURED_LINES ; line++)
+		{
+			lanes += pxl_pairs[line*(IMAGE_BUFFER_SIZE/2) + i] & RED_MASK_2PXL;
+			blue += (pxl_pairs[line*(IMAGE_BUFFER_SIZE/2) + i] >> BLUE_SHIFT) & BLUE_MASK_2PXL;
+		}
+
+		profile[2*i] = (lanes & LANE_MASK)/NB_CAPTURED_LINES;
+		profile[2*i+1] = (lanes >> LANE_SHIFT)/NB_CAPTURED_LINES;
+		goal_profile[2*i] = ((blue & LANE_MASK) << BLUE_SCALE)/NB_CAPTURED_LINES;
+		goal_profile[2*i+1] = ((blue >> LANE_SHIFT) << BLUE_SCALE)/NB_CAPTURED_LINES;
+		sum += profile[2*i] + profile[2*i+1];
+	}
+	band_brightness = sum/IMAGE_BUFFER_SIZE;
+}
+
+//value of one pixel of the band, in the same scale as the profile
+static uint8_t band_pixel(const uint8_t *band, uint8_t line, uint16_t i){
+	return band[2*(line*IMAGE_BUFFER_SIZE + i)] & 0xF8;
+}
+#endif
+
+/* ball_vertical_extent(captured band)
+ * Counts the captured lines where the detected segment is below the mean of the profile.
+ * Only the columns of the ball are read, so it stays cheap compared to reduce_band().
+ */
+static uint8_t ball_vertical_extent(const uint8_t *band){
+
+	uint8_t height = 0;
+	uint32_t sum = 0;
+
+	for(uint8_t line = 0 ; line < NB_CAPTURED_LINES ; line++)
+	{
+		sum = 0;
+		for(uint16_t i = ball_begin ; i < ball_end ; i++)
+			sum += band_pixel(band, line, i);
+
+		if(sum < (uint32_t)line_mean*(ball_end - ball_begin))
+			height++;
+	}
+	return height;
+}
 
 /*
  *  Updates ball_position (center point) extracted from the image buffer given
@@ -28,6 +222,7 @@ void extract_ball_pos(uint8_t *buffer){
 	for(uint16_t i = 0 ; i < IMAGE_BUFFER_SIZE ; i++)
 		mean += buffer[i];
 	mean /= IMAGE_BUFFER_SIZE;
+	line_mean = mean;
 
 	do{
 		wrong_ball = 0;
@@ -36,7 +231,7 @@ void extract_ball_pos(uint8_t *buffer){
 		{
 			//the slope must at least be WIDTH_SLOPE wide and is compared
 		    //to the mean of the image
-		    if(buffer[i] > mean && buffer[i+WIDTH_SLOPE] < mean)
+		    if(buffer[i] > mean && buffer[i+WIDTH_SLOPE] + threshold_margin < mean)
 		    {
 		        begin = i;
 		        stop = 1;
@@ -50,7 +245,7 @@ void extract_ball_pos(uint8_t *buffer){
 		    
 		    while(stop == 0 && i < IMAGE_BUFFER_SIZE)
 		    {
-		        if(buffer[i] > mean && buffer[i-WIDTH_SLOPE] < mean)
+		        if(buffer[i] > mean && buffer[i-WIDTH_SLOPE] + threshold_margin < mean)
 		        {
 		            end = i;
 		            stop = 1;
@@ -83,13 +278,362 @@ void extract_ball_pos(uint8_t *buffer){
 		seenLast = false;
 	else
 	{
+		ball_begin = begin;
+		ball_end = end;
 		ball_position = (begin + end)/2;
 		seenLast = true;
 	}
 }
 
+/* extract_goal_pos(goal profile)
+ * Looks for the widest run below the mean of the goal profile that doesn't overlap the ball.
+ * Updates goal_position and goalSeenLast.
+ */
+static void extract_goal_pos(const uint8_t *buffer){
+
+	uint16_t begin = 0, best_begin = 0, best_width = 0;
+	uint32_t mean = 0;
+	bool in_run = false;
+
+	for(uint16_t i = 0 ; i < IMAGE_BUFFER_SIZE ; i++)
+		mean += buffer[i];
+	mean /= IMAGE_BUFFER_SIZE;
+
+	for(uint16_t i = 0 ; i <= IMAGE_BUFFER_SIZE ; i++)
+	{
+		//the ball columns are skipped, a red ball is also a dip in the blue channel
+		if(i < IMAGE_BUFFER_SIZE && (uint32_t)buffer[i] + GOAL_MARGIN < mean
+			&& !(seenLast && i >= ball_begin && i <= ball_end))
+		{
+			if(!in_run)
+			{
+				begin = i;
+				in_run = true;
+			}
+		}
+		else if(in_run)
+		{
+			in_run = false;
+			if(i - begin > best_width)
+			{
+				best_width = i - begin;
+				best_begin = begin;
+			}
+		}
+	}
+
+	goalSeenLast = (best_width >= MIN_GOAL_WIDTH);
+	if(goalSeenLast)
+		goal_position = best_begin + best_width/2;
+}
+
+static uint8_t scale_gain(uint8_t default_gain){
+	uint16_t scaled = (default_gain*gain)/GAIN_UNITY;
+	return (scaled > GAIN_MAX) ? GAIN_MAX : scaled;
+}
+
+/* exposure_control(tracking active)
+ * While tracking, the integration time is driven toward AE_TARGET_MEAN but never above
+ * EXPOSURE_MAX, to hold TARGET_FPS. The missing light is compensated with the gains
+ * and the detection threshold margin grows with them. Outside tracking, the sensor AE is used.
+ */
+static void exposure_control(bool tracking){
+
+	static uint8_t frame_cnt = 0;
+	uint32_t wanted = 0;
+
+	if(!tracking)
+	{
+		if(ae_active)
+		{
+			po8030_set_rgb_gain(RED_GAIN_DEFAULT, GREEN_GAIN_DEFAULT, BLUE_GAIN_DEFAULT);
+			po8030_set_ae(1);
+			ae_active = false;
+			threshold_margin = 0;
+		}
+		return;
+	}
+
+	if(!ae_active)
+	{
+		po8030_set_ae(0);
+		exposure = EXPOSURE_INIT;
+		gain = GAIN_UNITY;
+		po8030_set_exposure(exposure, 0);
+		ae_active = true;
+		frame_cnt = 0;
+		return;
+	}
+
+	if(++frame_cnt < AE_PERIOD_FRAMES)
+		return;
+	frame_cnt = 0;
+
+	if(abs(band_brightness - AE_TARGET_MEAN) <= AE_TOLERANCE)
+		return;
+
+	//total amount of light wanted, expressed as exposure*gain, at most doubled or halved per step
+	wanted = ((uint32_t)exposure*gain*AE_TARGET_MEAN)/(band_brightness ? band_brightness : 1);
+	if(wanted > 2*(uint32_t)exposure*gain)
+		wanted = 2*(uint32_t)exposure*gain;
+	else if(wanted < ((uint32_t)exposure*gain)/2)
+		wanted = ((uint32_t)exposure*gain)/2;
+
+	//exposure first, gain only when the frame rate cap is reached
+	exposure = wanted/GAIN_UNITY;
+	if(exposure > EXPOSURE_MAX)
+		exposure = EXPOSURE_MAX;
+	else if(exposure < EXPOSURE_MIN)
+		exposure = EXPOSURE_MIN;
+
+	gain = wanted/exposure;
+	if(gain > GAIN_MAX)
+		gain = GAIN_MAX;
+	else if(gain < GAIN_UNITY)
+		gain = GAIN_UNITY;
+
+	threshold_margin = (gain - GAIN_UNITY) >> GAIN_MARGIN_SHIFT;
+
+	po8030_set_exposure(exposure, 0);
+	po8030_set_rgb_gain(scale_gain(RED_GAIN_DEFAULT), scale_gain(GREEN_GAIN_DEFAULT), scale_gain(BLUE_GAIN_DEFAULT));
+}
+
+/* update_rates(ball analysed, ball seen)
+ * Counts the captured frames and the successful detections over FPS_WINDOW_MS
+ */
+static void update_rates(bool analysed, bool seen){
+
+	static systime_t time_window = 0;
+	static uint8_t frames = 0, analysed_cnt = 0, seen_cnt = 0;
+
+	frames++;
+	if(analysed)
+		analysed_cnt++;
+	if(seen)
+		seen_cnt++;
+
+	if(chVTGetSystemTime() - time_window >= MS2ST(FPS_WINDOW_MS))
+	{
+		capture_fps = frames;
+		detection_rate = analysed_cnt ? (100*seen_cnt)/analysed_cnt : 0;
+		frames = analysed_cnt = seen_cnt = 0;
+		time_window = chVTGetSystemTime();
+	}
+}
+
+/*THREAD: FrameWait
+ * wait_image_ready() of the library has no timeout. This thread blocks on it and forwards
+ * each end of capture to frame_ready, which the capture thread waits with a deadline.
+ */
+static THD_WORKING_AREA(waFrameWait, 128);
+static THD_FUNCTION(FrameWait, arg){
+
+    chRegSetThreadName(__FUNCTION__);
+    (void)arg;
+
+    while(1)
+    {
+		wait_image_ready();
+		chBSemSignal(&frame_ready);
+    }
+}
+
+/* wait_frame(tracking active, with the exposure capped)
+ * Blocks until the end of the capture, at most FRAME_TIMEOUT_MS while tracking and
+ * FRAME_TIMEOUT_AE_MS under the sensor AE. Returns false if the frame is lost, the capture is then
+ * stopped to be re-armed by the caller.
+ */
+static bool wait_frame(bool tracking){
+
+	static bool lost_previous = false;
+	systime_t time_start = chVTGetSystemTime();
+	systime_t timeout = MS2ST(tracking ? FRAME_TIMEOUT_MS : FRAME_TIMEOUT_AE_MS), elapsed = 0;
+
+	//a signal left by an aborted capture is only a wake-up, the image flag decides
+	while(!image_is_ready())
+	{
+		elapsed = chVTGetSystemTime() - time_start;
+		if(elapsed >= timeout || chBSemWaitTimeout(&frame_ready, timeout - elapsed) != MSG_OK)
+		{
+			dcmi_capture_stop();
+			frame_stats.dropped++;
+			lost_previous = true;
+			return false;
+		}
+	}
+
+	if(tracking && chVTGetSystemTime() - time_start > MS2ST(FRAME_LATE_MS))
+		frame_stats.late++;
+	if(lost_previous)
+	{
+		frame_stats.recovered++;
+		lost_previous = false;
+	}
+	return true;
+}
+
+static void cycle_counter_start(void){
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/* worst_case_line(profile, kind of line)
+ * Fills the profile with one of the slowest inputs of extract_ball_pos(): no edge at all,
+ * a comb of dips too narrow to be the ball (each one is found and then rescanned),
+ * a begin without end, and the ball only at the right end. The cost of the function is
+ * linear in the width, these lines take the most branches per pixel.
+ */
+static void worst_case_line(uint8_t *buffer, enum wcetLine kind){
+
+	for(uint16_t i = 0 ; i < IMAGE_BUFFER_SIZE ; i++)
+	{
+		switch(kind)
+		{
+			case WCET_COMB:
+				buffer[i] = ((i/WCET_COMB_HALF) % 2) ? WCET_LOW : WCET_HIGH;
+				break;
+			case WCET_NO_END:
+				buffer[i] = (i < IMAGE_BUFFER_SIZE/4) ? WCET_HIGH : WCET_LOW;
+				break;
+			case WCET_LAST_BALL:
+				buffer[i] = (i >= IMAGE_BUFFER_SIZE - MIN_OBJ_WIDTH - WIDTH_SLOPE && i < IMAGE_BUFFER_SIZE - WIDTH_SLOPE)
+							? WCET_LOW : WCET_HIGH;
+				break;
+			default:
+				buffer[i] = WCET_HIGH;
+				break;
+		}
+	}
+}
+
+/* measure_extract(profile)
+ * Execution time of extract_ball_pos() in cycles, preemptions included.
+ */
+static uint32_t measure_extract(uint8_t *buffer){
+
+	uint32_t start = DWT->CYCCNT;
+
+	extract_ball_pos(buffer);
+	return DWT->CYCCNT - start;
+}
+
+/* extract_selftest(profile buffer)
+ * Times extract_ball_pos() on each worst-case line before the first capture, so a build over
+ * budget is caught at startup rather than on the first adversarial scene. The detection
+ * results are reset afterwards.
+ */
+static void extract_selftest(uint8_t *buffer){
+
+	uint32_t cycles = 0;
+
+	//the kernel is locked so a preemption can't be taken for an overrun, the robot isn't moving yet
+	for(uint8_t kind = 0 ; kind < WCET_NB_LINES ; kind++)
+	{
+		worst_case_line(buffer, kind);
+		chSysLock();
+		cycles = measure_extract(buffer);
+		chSysUnlock();
+		if(cycles > extract_timing.worst_case)
+			extract_timing.worst_case = cycles;
+	}
+	seenLast = false;
+	ball_begin = ball_end = 0;
+	ball_position = IMAGE_BUFFER_SIZE/2;
+	if(extract_timing.worst_case <= EXTRACT_BUDGET_CYCLES)
+		return;
+	extract_timing.overruns++;
+#if EXTRACT_HALT_ON_OVERRUN
+	chSysHalt("extract_ball_pos over budget");
+#endif
+}
+
+/* timed_extract_ball_pos(profile)
+ * Calls extract_ball_pos() and keeps the last and worst execution times in cycles.
+ * Its control flow depends on the image (rescans after narrow segments), so the worst case
+ * is bounded at startup by extract_selftest() and watched on every frame. The interrupts
+ * stay enabled during the frames: a time over budget may include a preemption, it is only
+ * counted.
+ */
+static void timed_extract_ball_pos(uint8_t *buffer){
+
+	extract_timing.last = measure_extract(buffer);
+	if(extract_timing.last > extract_timing.max)
+		extract_timing.max = extract_timing.last;
+	if(extract_timing.last > EXTRACT_BUDGET_CYCLES)
+		extract_timing.overruns++;
+}
+
+//distance driven by the robot, from the wheel steps [steps]
+static int32_t robot_steps(void){
+	return (left_motor_get_pos() + right_motor_get_pos())/2;
+}
+
+/* verify_shot(reset)
+ * Called on each frame of SHOT_VERIFY. The distance of the ball is estimated from its apparent
+ * width. The robot is still braking after the contact, so the distance it drove between the
+ * first and last sightings is added back: that gives the displacement of the ball on the table
+ * and its launch speed. The ball is missed if it is never seen or doesn't move away enough.
+ * If the frames stop coming, the state machine ends SHOT_VERIFY as a miss on its own.
+ */
+static void verify_shot(bool reset){
+
+	static uint8_t frame_cnt = 0;
+	static bool seen = false;
+	static uint16_t first_dist = 0, last_dist = 0;
+	static int32_t first_steps = 0, last_steps = 0;
+	static systime_t first_time = 0, last_time = 0;
+
+	int32_t travel = 0;
+	bool hit = false;
+
+	if(reset)
+	{
+		frame_cnt = 0;
+		seen = false;
+		return;
+	}
+
+	if(seenLast)
+	{
+		last_dist = getBallDistMm();
+		last_steps = robot_steps();
+		last_time = frame_time;
+		if(!seen)
+		{
+			first_dist = last_dist;
+			first_steps = last_steps;
+			first_time = last_time;
+			seen = true;
+		}
+	}
+
+	if(++frame_cnt < SHOT_VERIFY_FRAMES)
+		return;
+
+	travel = (int32_t)last_dist - first_dist + STEPS_TO_MM(last_steps - first_steps);
+	hit = seen && travel > SHOT_MIN_DISP_MM;
+	if(hit)
+	{
+		shot_stats.hits++;
+		shot_stats.launch_speed = (travel*MS_PER_S)/ST2MS(last_time - first_time);
+	}
+	else
+	{
+		shot_stats.misses++;
+		shot_stats.launch_speed = 0;
+	}
+	switchState(hit);
+}
+
+//the ball is only looked for in these states, in MANUAL_MOVE for the obstacle avoidance
+static bool tracking_state(void){
+	return getState() == MANUAL_MOVE || getState() == SEARCH_BALL || getState() == BALL_LOCKED
+			|| getState() == SHOT_VERIFY;
+}
+
 /* THREAD CaptureProcessImg */
-static THD_WORKING_AREA(waCaptureProcessImg, 1024);
+static THD_WORKING_AREA(waCaptureProcessImg, 2048); //the two profiles of IMAGE_BUFFER_SIZE are on its stack
 static THD_FUNCTION(CaptureProcessImg, arg){
 
     chRegSetThreadName(__FUNCTION__);
@@ -97,35 +641,73 @@ static THD_FUNCTION(CaptureProcessImg, arg){
 
 	uint8_t *img_buff_ptr;
 	uint8_t image[IMAGE_BUFFER_SIZE] = {0};
+	uint8_t goal_image[IMAGE_BUFFER_SIZE] = {0};
 
-	//Takes pixels 0 to IMAGE_BUFFER_SIZE of specified line
-	po8030_advanced_config(FORMAT_RGB565, 0, CAPTURE_LINE_NB, IMAGE_BUFFER_SIZE, NB_CAPTURED_LINES, SUBSAMPLING_X1, SUBSAMPLING_X1);
+	//Takes pixels 0 to IMAGE_BUFFER_SIZE of a band of lines centered on CAPTURE_LINE_NB
+#if CAPTURE_FORMAT == CAPTURE_FORMAT_YUV422
+	po8030_advanced_config(FORMAT_YCBYCR, 0, FIRST_CAPTURED_LINE, IMAGE_BUFFER_SIZE, NB_CAPTURED_LINES, SUBSAMPLING_X1, SUBSAMPLING_X1);
+#else
+	po8030_advanced_config(FORMAT_RGB565, 0, FIRST_CAPTURED_LINE, IMAGE_BUFFER_SIZE, NB_CAPTURED_LINES, SUBSAMPLING_X1, SUBSAMPLING_X1);
+#endif
 	dcmi_enable_double_buffering();
 	dcmi_set_capture_mode(CAPTURE_ONE_SHOT);
 	dcmi_prepare();
+	cycle_counter_start();
+	extract_selftest(image);
+
+    bool tracking = false;
 
     while(1)
     {
+		//the exposure is set before the capture, so the frame comes within its deadline
+		tracking = tracking_state();
+		exposure_control(EXPOSURE_CONTROL && tracking);
+
         //starts a capture
+		chBSemReset(&frame_ready, true);
 		dcmi_capture_start();
-		//waits for the capture to be done
-		wait_image_ready();
+		//waits for the capture to be done, restarts it if the frame is lost
+		if(!wait_frame(EXPOSURE_CONTROL && tracking))
+			continue;
 		img_buff_ptr = dcmi_get_last_image_ptr();
 
 		//If the state is matching, analyze the image to find ball position
-		if(getState() == SEARCH_BALL || getState() == BALL_LOCKED)
+		tracking = tracking_state();
+		if(tracking)
 		{
-			//Extracts only the red pixels
-			for(uint16_t i = 0 ; i < (2 * IMAGE_BUFFER_SIZE) ; i+=2)
-				image[i/2] = (uint8_t)img_buff_ptr[i]&0xF8;
+			//Extracts only the red (or V chroma) pixels, averaged over the lines of the band
+			reduce_band(img_buff_ptr, image, goal_image);
 
 			//search for a discontinuity in the image and gets its position
-			extract_ball_pos(image);
+			timed_extract_ball_pos(image);
+			extract_goal_pos(goal_image);
+
+			if(seenLast)
+				ball_height = ball_vertical_extent(img_buff_ptr);
+			else
+				ball_height = 0;
+		}
+		else
+		{
+			//not analysed: nothing is seen on this frame
+			seenLast = goalSeenLast = false;
+			ball_height = 0;
+			verify_shot(true);
 		}
+
+		//every frame is numbered, the results above belong to it
+		frame_time = chVTGetSystemTime();
+		frame_seq++;
+		chEvtBroadcast(&frame_event);
+
+		if(tracking && getState() == SHOT_VERIFY)
+			verify_shot(false);
+		update_rates(tracking, tracking && seenLast);
     }
 }
 
 void capture_process_img_start(void){
+	chThdCreateStatic(waFrameWait, sizeof(waFrameWait), NORMALPRIO+1, FrameWait, NULL);
 	chThdCreateStatic(waCaptureProcessImg, sizeof(waCaptureProcessImg), NORMALPRIO, CaptureProcessImg, NULL);
 }
 
@@ -134,5 +716,57 @@ uint16_t getBallPos(){
 }
 
 bool ballSeenLast() {
-	return seenLast;
+	//a result older than MAX_RESULT_AGE_MS means frames are lost, don't steer on it
+	return seenLast && (chVTGetSystemTime() - frame_time <= MS2ST(MAX_RESULT_AGE_MS));
+}
+
+//apparent width = FOCAL_PXL*BALL_DIAMETER_MM/distance
+uint16_t getBallDistMm(){
+	if(ball_end <= ball_begin)
+		return 0;
+	return (FOCAL_PXL*BALL_DIAMETER_MM)/(ball_end - ball_begin);
+}
+
+uint16_t getGoalPos(){
+	return goal_position;
+}
+
+bool goalSeen(){
+	return goalSeenLast && (chVTGetSystemTime() - frame_time <= MS2ST(MAX_RESULT_AGE_MS));
+}
+
+uint8_t getBallHeight(){
+	return ball_height;
+}
+
+uint8_t getCaptureFps(){
+	return capture_fps;
+}
+
+uint8_t getDetectionRate(){
+	return detection_rate;
+}
+
+event_source_t* getFrameEvent(){
+	return &frame_event;
+}
+
+uint32_t getFrameSeq(){
+	return frame_seq;
+}
+
+systime_t getFrameTime(){
+	return frame_time;
+}
+
+frame_stats_t getFrameStats(){
+	return frame_stats;
+}
+
+extract_timing_t getExtractTiming(){
+	return extract_timing;
+}
+
+shot_stats_t getShotStats(){
+	return shot_stats;
 }
@@ -1,8 +1,52 @@
 #ifndef PROCESS_IMAGE_H
 #define PROCESS_IMAGE_H
 
+//counters of the frame acquisition
+typedef struct {
+	uint32_t dropped;	//frames not received before the timeout
+	uint32_t late;		//frames received after the expected period, while tracking
+	uint32_t recovered;	//captures successfully re-armed after a drop
+} frame_stats_t;
+
+//execution time of the ball extraction, in cpu cycles
+typedef struct {
+	uint32_t last;
+	uint32_t max;
+	uint32_t worst_case;	//on the synthetic worst-case lines, at startup
+	uint32_t overruns;	//executions above the configured budget, preemptions included
+} extract_timing_t;
+
+//outcome of the shots checked by the camera
+typedef struct {
+	uint16_t hits;
+	uint16_t misses;
+	uint16_t launch_speed;	//speed of the last hit [mm/s]
+} shot_stats_t;
+
 void capture_process_img_start(void);
 uint16_t getBallPos(void);
 bool ballSeenLast(void);
+//distance to the ball estimated from its apparent width, only valid if the ball is seen
+uint16_t getBallDistMm(void);
+//farthest distance getBallDistMm() can return: a narrower ball is not detected
+//(FOCAL_PXL*BALL_DIAMETER_MM/MIN_OBJ_WIDTH, checked in process_image.c)
+#define BALL_DIST_MAX_MM		394
+//position of the yellow goal marker, found in the same band as the ball
+uint16_t getGoalPos(void);
+bool goalSeen(void);
+//number of captured lines covered by the ball, 0 if not seen
+uint8_t getBallHeight(void);
+//frames captured during the last second
+uint8_t getCaptureFps(void);
+//percentage of the analysed frames of the last second where the ball was found
+uint8_t getDetectionRate(void);
+//broadcast after each frame, analysed or not
+event_source_t* getFrameEvent(void);
+//sequence number and arrival time of the last frame
+uint32_t getFrameSeq(void);
+systime_t getFrameTime(void);
+frame_stats_t getFrameStats(void);
+extract_timing_t getExtractTiming(void);
+shot_stats_t getShotStats(void);
 
 #endif /* PROCESS_IMAGE_H */
@@ -0,0 +1,42 @@
+#ifndef REGULATOR_TUNING_H
+#define REGULATOR_TUNING_H
+
+#include <motors.h>
+
+//Tunable parameters of eputt_regulator.c, overridden by compiler defines (UDEFS), e.g. with
+//the values found offline by host/tune.c. The host tests check these very defaults.
+
+//Bearing controller
+#ifndef KP
+#define KP					1.0f //0.5 with the former PI regulator (host/test_pid.c)
+#endif
+#ifndef KI
+#define KI 					0.10f //0.15 overshoots small offsets when the camera is two frames late
+#endif
+#ifndef KD
+#define KD					0.0f //the camera is too noisy to derivate, kept for tuning
+#endif
+#ifndef KI_PRIOR
+#define KI_PRIOR				0.93f
+#endif
+#define MAX_SUM_ERROR 		(MOTOR_SPEED_LIMIT/(5*KI))
+
+//Precision of alignment
+#ifndef ROTATION_THRESHOLD
+#define ROTATION_THRESHOLD	10	//pxl, cannot align perfectly anyway
+#endif
+//Alignment is declared from the statistics of the last fresh frames, not a count of
+//consecutive ones: a single bad frame doesn't restart it, a biased or noisy lock isn't taken.
+#ifndef ALIGN_WINDOW
+#define ALIGN_WINDOW			6 //fresh frames
+#endif
+#ifndef ALIGN_MIN_SAMPLES
+#define ALIGN_MIN_SAMPLES	3
+#endif
+//standard errors of the mean that must fit in ROTATION_THRESHOLD, 2 would decide a frame
+//later than the counter of consecutive frames did
+#ifndef ALIGN_CONFIDENCE
+#define ALIGN_CONFIDENCE		1.6f
+#endif
+
+#endif /* REGULATOR_TUNING_H */
@@ -0,0 +1,285 @@
+#include "ch.h"
+#include "hal.h"
+
+#include <main.h>
+#include <state_machine.h>
+#include <led_sequencer.h>
+
+//Retry policy after a failed search or charge, before giving the hand back to the operator
+#ifndef RETRY_MAX
+#define RETRY_MAX			2 //automatic searches after a failure
+#endif
+#ifndef RETRY_BACKOFF_MS
+#define RETRY_BACKOFF_MS		1000 //pause before searching again, lets a pushed ball settle
+#endif
+//The camera decides on SHOT_VERIFY_FRAMES frames, a shot it can't decide on is a miss
+#ifndef SHOT_VERIFY_TIMEOUT_MS
+#define SHOT_VERIFY_TIMEOUT_MS	1500
+#endif
+//1: a transition with a pattern holds the robot until the pattern has played, as the LED states
+//did before the sequencer (NBCYCLES_MAIN_LEDS + 1 ticks of the 200 ms main loop), to compare them
+#ifndef LED_BLOCKING
+#define LED_BLOCKING			0
+#endif
+#define LED_HOLD_MS			1600
+#define LED_HOLD				NB_STATES //read by getState() during the hold, no module acts on it
+
+//Transitions are posted by any thread and applied by the StateMachine thread only.
+//It is above every thread posting, so a post returns with the transition already applied.
+//A post from a thread that isn't below it is counted, it returns before being applied.
+#define STATE_QUEUE_SIZE		8
+#define STATE_OWNER_PRIO		(NORMALPRIO+2)
+#define STATE_POST_TIMEOUT_MS	TIME_MS_PIDREG //wait for room in the queue, then the post is lost
+
+//Each entry in a state is numbered: a post names the entry it ends, not only the state, so a
+//late post can't end a later entry in the same state (A-B-A). State and number are one word.
+#define STATE_BITS			3
+#define STATE_ENTRY_MASK		0x3FFFFFFF //fits in a message with the outcome
+#define STATE_ENTRY(seq, state)	((((uint32_t)(seq) << STATE_BITS) | (state)) & STATE_ENTRY_MASK)
+#define STATE_ENTRY_STATE(entry)	((enum eputtState)((entry) & ((1 << STATE_BITS) - 1)))
+#define STATE_ENTRY_SEQ(entry)	((entry) >> STATE_BITS)
+#define STATE_MSG(entry, success)	((msg_t)(((entry) << 1) | ((success) ? 1 : 0)))
+#define STATE_MSG_ENTRY(msg)		((uint32_t)(msg) >> 1)
+#define STATE_MSG_SUCCESS(msg)	(((msg) & 1) != 0)
+_Static_assert(NB_STATES <= (1 << STATE_BITS), "STATE_BITS too small for the states");
+_Static_assert(!LED_BLOCKING || LED_HOLD < (1 << STATE_BITS), "STATE_BITS too small for the hold");
+
+static enum eputtState curr_state = STARTUP; //owned by the StateMachine thread
+static volatile uint32_t state_entry = STATE_ENTRY(0, STARTUP); //snapshot read by all
+static msg_t state_queue_buf[STATE_QUEUE_SIZE];
+static MAILBOX_DECL(state_queue, state_queue_buf, STATE_QUEUE_SIZE);
+static state_queue_stats_t state_queue_stats = {0};
+static EVENTSOURCE_DECL(state_event);
+static shot_cycle_stats_t cycle_stats = {0};
+static systime_t time_state = 0; //entry in the current state
+static systime_t time_ended = 0; //end of the previous state, before the hold of LED_BLOCKING
+static uint8_t retries = 0;
+
+//Description of a state: where it goes when it ends, the leds it shows and what it does.
+//The patterns are played on the transition, alongside the next state.
+typedef struct {
+	enum eputtState state;		//its own index, checked at start: a row left out reads as STARTUP
+	enum eputtState on_success;
+	enum eputtState on_failure;
+	enum ledPattern success_pattern;
+	enum ledPattern failure_pattern;
+	uint8_t leds;				//steady leds during the state, SEQ_xxx
+	void (*entry)(void);			//NULL if nothing to do
+	void (*exit)(void);
+	uint16_t timeout_ms;			//the state ends on its own after it, 0 for never
+	bool (*outcome)(void);		//success when it times out, NULL for always
+} state_desc_t;
+
+static void startup_entry(void){
+	retries = 0;
+}
+
+static void manual_entry(void){
+	retries = 0; //the operator has the hand back
+}
+
+static void retry_exit(void){
+	retries++;
+}
+
+//try again on its own a few times, then back to the operator
+static bool retry_allowed(void){
+	return retries < RETRY_MAX;
+}
+
+static bool shot_unverified(void){
+	return false;
+}
+
+static const state_desc_t state_table[] = {
+	//						state			success			failure			success pattern		failure pattern
+	//						leds					entry			exit			timeout			outcome
+	[STARTUP]		= {STARTUP,			MANUAL_MOVE,		MANUAL_MOVE,		PATTERN_NONE,		PATTERN_NONE,
+						SEQ_LED3 | SEQ_LED7,	startup_entry,	NULL,		0,				NULL},
+	[MANUAL_MOVE]	= {MANUAL_MOVE,		SEARCH_BALL,		SEARCH_BALL,		PATTERN_MV_SB,		PATTERN_MV_SB,
+						SEQ_BODY,			manual_entry,	NULL,		0,				NULL},
+	[SEARCH_BALL]	= {SEARCH_BALL,		BALL_LOCKED,		RETRY_BACKOFF,	PATTERN_NONE,		PATTERN_BALL_NF,
+						SEQ_LED1,			NULL,			NULL,		0,				NULL},
+	[BALL_LOCKED]	= {BALL_LOCKED,		CHARGE_BALL,		RETRY_BACKOFF,	PATTERN_NONE,		PATTERN_BALL_NF,
+						0,					NULL,			NULL,		0,				NULL},
+	[CHARGE_BALL]	= {CHARGE_BALL,		SHOT_VERIFY,		RETRY_BACKOFF,	PATTERN_NONE,		PATTERN_BALL_NF,
+						0,					NULL,			NULL,		0,				NULL},
+	//the camera confirms that the ball really left.
+	//succesful shot: go in reset state as it may be the end of the game
+	[SHOT_VERIFY]	= {SHOT_VERIFY,		STARTUP,			RETRY_BACKOFF,	PATTERN_SUCCESS,		PATTERN_BALL_NF,
+						0,					NULL,			NULL,		SHOT_VERIFY_TIMEOUT_MS,	shot_unverified},
+	[RETRY_BACKOFF]	= {RETRY_BACKOFF,	SEARCH_BALL,		MANUAL_MOVE,		PATTERN_NONE,		PATTERN_NONE,
+						0,					NULL,			retry_exit,	RETRY_BACKOFF_MS,	retry_allowed},
+};
+_Static_assert(sizeof(state_table)/sizeof(state_table[0]) == NB_STATES, "state_table must describe every state");
+
+static void setState(enum eputtState new_eputtState);
+
+/* led_hold()
+ * The robot waits for the pattern in none of the states, as in the LED states of before.
+ */
+static void led_hold(void){
+	state_entry = STATE_ENTRY(STATE_ENTRY_SEQ(state_entry) + 1, LED_HOLD);
+	led_sequencer_set_steady(0);
+	chEvtBroadcast(&state_event);
+	chThdSleepMilliseconds(LED_HOLD_MS);
+}
+
+/*THREAD: StateMachine*/
+static THD_WORKING_AREA(waStateMachine, 256);
+static THD_FUNCTION(StateMachine, arg){
+
+    chRegSetThreadName(__FUNCTION__);
+    (void)arg;
+
+    const state_desc_t *state;
+    enum ledPattern pattern;
+    systime_t timeout, elapsed;
+    msg_t msg;
+
+    while(1)
+    {
+		timeout = TIME_INFINITE;
+		if(state_table[curr_state].timeout_ms)
+		{
+			elapsed = chVTGetSystemTime() - time_state;
+			timeout = MS2ST(state_table[curr_state].timeout_ms);
+			timeout = (elapsed < timeout) ? timeout - elapsed : TIME_IMMEDIATE;
+		}
+
+		//a state with a timeout ends on its own, its outcome tells how
+		if(chMBFetch(&state_queue, &msg, timeout) != MSG_OK)
+			msg = STATE_MSG(state_entry, state_table[curr_state].outcome ? state_table[curr_state].outcome() : true);
+
+		//the poster ended an entry that is already left (e.g. two threads ending the same one): ignore
+		if(STATE_MSG_ENTRY(msg) != state_entry)
+		{
+			state_queue_stats.stale++;
+			continue;
+		}
+		state_queue_stats.applied++;
+
+		//the animation runs on its own, the next state doesn't wait for it
+		state = &state_table[curr_state];
+		pattern = STATE_MSG_SUCCESS(msg) ? state->success_pattern : state->failure_pattern;
+		time_ended = chVTGetSystemTime();
+		led_sequencer_play(pattern);
+		if(LED_BLOCKING && pattern != PATTERN_NONE)
+			led_hold();
+		setState(STATE_MSG_SUCCESS(msg) ? state->on_success : state->on_failure);
+    }
+}
+
+/* post_transition(entry ended, success of the state)
+ * The queue is only full if the owner can't run: the post waits STATE_POST_TIMEOUT_MS at most,
+ * then the transition is lost (counted, should never happen).
+ */
+static void post_transition(uint32_t entry, bool opSuccess){
+
+	bool inverted = chThdGetPriorityX() >= STATE_OWNER_PRIO;
+	bool dropped = chMBPost(&state_queue, STATE_MSG(entry, opSuccess), MS2ST(STATE_POST_TIMEOUT_MS)) != MSG_OK;
+
+	chSysLock();
+	state_queue_stats.inverted += inverted;
+	state_queue_stats.dropped += dropped;
+	chSysUnlock();
+}
+
+/* switchState(boolean - success of current operation)
+ * This is the State machine of the whole system, see state_table.
+ * The rest of the program doesn't know how the system work. Functions & threads just checks for
+ * specific states and tell back the state machine if their task was successful or not.
+ * The transition is applied by the StateMachine thread, from the entry seen when posting.
+ */
+void switchState(bool opSuccess){
+	post_transition(state_entry, opSuccess);
+}
+
+/* cycle_stats_update(new state)
+ * Measures the time to lock and to shoot from the start of the search, and the success rate.
+ * The cycle starts when the operator ends MANUAL_MOVE. Called before the current state is replaced.
+ */
+static void cycle_stats_update(enum eputtState new_eputtState){
+
+	static systime_t time_search = 0, time_cycle = 0;
+
+	switch(new_eputtState)
+	{
+		case SEARCH_BALL:
+			time_search = chVTGetSystemTime();
+			cycle_stats.attempts++;
+			if(curr_state == MANUAL_MOVE)
+				time_cycle = time_ended;
+			else if(curr_state == RETRY_BACKOFF)
+				cycle_stats.retries++;
+			break;
+		case BALL_LOCKED:
+			cycle_stats.time_to_lock_ms = ST2MS(chVTGetSystemTime() - time_search);
+			break;
+		case SHOT_VERIFY:
+			cycle_stats.time_to_shot_ms = ST2MS(chVTGetSystemTime() - time_search);
+			break;
+		case STARTUP:
+			if(curr_state == SHOT_VERIFY)
+			{
+				cycle_stats.successes++;
+				cycle_stats.cycle_time_ms = ST2MS(chVTGetSystemTime() - time_cycle);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static void setState(enum eputtState new_eputtState){
+	if(state_table[curr_state].exit)
+		state_table[curr_state].exit();
+	cycle_stats_update(new_eputtState);
+	time_state = chVTGetSystemTime();
+	curr_state = new_eputtState;
+	state_entry = STATE_ENTRY(STATE_ENTRY_SEQ(state_entry) + 1, new_eputtState);
+	led_sequencer_set_steady(state_table[curr_state].leds);
+	if(state_table[curr_state].entry)
+		state_table[curr_state].entry();
+	chEvtBroadcast(&state_event);
+}
+
+/* check_state_table()
+ * Each row must be at the index of its state: a state left out of the table would otherwise
+ * be a row of zeros, read as STARTUP going to STARTUP. Halts on the first wrong row, also
+ * without the debug asserts.
+ */
+static void check_state_table(void){
+	for(uint8_t i = 0 ; i < NB_STATES ; i++)
+	{
+		if(state_table[i].state != i)
+			chSysHalt("state_table row out of place");
+		if(state_table[i].on_success >= NB_STATES || state_table[i].on_failure >= NB_STATES)
+			chSysHalt("state_table goes to an unknown state");
+		if(state_table[i].success_pattern >= NB_PATTERNS || state_table[i].failure_pattern >= NB_PATTERNS)
+			chSysHalt("state_table plays an unknown pattern");
+	}
+}
+
+void state_machine_start(void){
+	check_state_table();
+	setState(STARTUP);
+	chThdCreateStatic(waStateMachine, sizeof(waStateMachine), STATE_OWNER_PRIO, StateMachine, NULL);
+}
+
+enum eputtState getState(){
+	return STATE_ENTRY_STATE(state_entry);
+}
+
+event_source_t* getStateEvent(){
+	return &state_event;
+}
+
+shot_cycle_stats_t getShotCycleStats(){
+	return cycle_stats;
+}
+
+state_queue_stats_t getStateQueueStats(){
+	return state_queue_stats;
+}
+
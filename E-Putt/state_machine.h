@@ -0,0 +1,9 @@
+#ifndef STATE_MACHINE_H
+#define STATE_MACHINE_H
+
+//The states and the calls of the other modules are in main.h
+
+//checks the state table, enters STARTUP and starts the thread applying the transitions
+void state_machine_start(void);
+
+#endif /* STATE_MACHINE_H */
@@ -0,0 +1,129 @@
+#include "ch.h"
+#include "hal.h"
+
+#include <i2c_bus.h>
+#include <sensors/VL53L0X/VL53L0X.h>
+
+#include <main.h>
+#include <tof.h>
+
+//Polling period of each mode, just above the timing budget of the sensor
+#define TOF_PERIOD_DEFAULT_MS	100
+#define TOF_PERIOD_FAST_MS		25 //VL53L0X_HIGH_SPEED has a 20ms budget
+#define TOF_MAX_RANGE_MM			2000 //beyond, the sensor returns no target codes
+#define MEDIAN_SIZE				3
+
+static tof_sample_t last_sample = {0};
+static EVENTSOURCE_DECL(tof_event);
+
+//last valid measures of the current mode
+static uint16_t history[MEDIAN_SIZE] = {0};
+static uint8_t history_cnt = 0, history_index = 0;
+
+//the short timing budget is only needed while the ball is approached
+static bool fast_mode_needed(void){
+	return getState() == BALL_LOCKED || getState() == CHARGE_BALL;
+}
+
+//the measures of the previous mode don't enter the median of the new one
+static void tof_set_mode(VL53L0X_Dev_t *device, bool fast){
+	history_cnt = history_index = 0;
+	VL53L0X_stopMeasure(device);
+	VL53L0X_configAccuracy(device, fast ? VL53L0X_HIGH_SPEED : VL53L0X_LONG_RANGE);
+	VL53L0X_startMeasure(device, VL53L0X_DEVICEMODE_CONTINUOUS_RANGING);
+}
+
+/* median_filter(new raw measure, median)
+ * Median of the last MEDIAN_SIZE valid measures, removes isolated outliers.
+ * Returns false until MEDIAN_SIZE measures are known.
+ */
+static bool median_filter(uint16_t dist, uint16_t *median){
+
+	uint16_t a = 0, b = 0, c = 0;
+
+	history[history_index] = dist;
+	history_index = (history_index + 1) % MEDIAN_SIZE;
+	if(history_cnt < MEDIAN_SIZE)
+		history_cnt++;
+	if(history_cnt < MEDIAN_SIZE)
+		return false;
+
+	a = history[0];
+	b = history[1];
+	c = history[2];
+	if((a <= b && b <= c) || (c <= b && b <= a))
+		*median = b;
+	else if((b <= a && a <= c) || (c <= a && a <= b))
+		*median = a;
+	else
+		*median = c;
+	return true;
+}
+
+/*THREAD: TimeOfFlight*/
+static THD_WORKING_AREA(waTimeOfFlight, 512);
+static THD_FUNCTION(TimeOfFlight, arg){
+
+    chRegSetThreadName(__FUNCTION__);
+    (void)arg;
+
+    VL53L0X_Dev_t device;
+    VL53L0X_Error status = VL53L0X_ERROR_NONE;
+    bool fast = false;
+    uint16_t raw = 0;
+    tof_sample_t sample = {0};
+
+    device.I2cDevAddr = VL53L0X_ADDR;
+    status = VL53L0X_init(&device);
+    if(status == VL53L0X_ERROR_NONE)
+    		status = VL53L0X_configAccuracy(&device, VL53L0X_LONG_RANGE);
+    if(status == VL53L0X_ERROR_NONE)
+    		status = VL53L0X_startMeasure(&device, VL53L0X_DEVICEMODE_CONTINUOUS_RANGING);
+    if(status != VL53L0X_ERROR_NONE)
+    		return; //no sensor, the samples stay invalid
+
+    while(1)
+    {
+		if(fast_mode_needed() != fast)
+		{
+			fast = !fast;
+			tof_set_mode(&device, fast);
+		}
+
+		chThdSleepMilliseconds(fast ? TOF_PERIOD_FAST_MS : TOF_PERIOD_DEFAULT_MS);
+
+		//stamped at the read, the filtering time doesn't count
+		sample.time = chVTGetSystemTime();
+		VL53L0X_getLastMeasure(&device);
+		raw = device.Data.LastRangeMeasure.RangeMilliMeter;
+
+		//0 and no target codes are not distances, they don't enter the filter
+		sample.valid = (raw > 0 && raw < TOF_MAX_RANGE_MM) && median_filter(raw, &sample.dist_mm);
+		sample.seq++;
+
+		//read by other threads, replaced as a whole
+		chSysLock();
+		last_sample = sample;
+		chSysUnlock();
+		chEvtBroadcast(&tof_event);
+    }
+}
+
+void tof_start(void){
+	i2c_start();
+	chThdCreateStatic(waTimeOfFlight, sizeof(waTimeOfFlight), NORMALPRIO+1, TimeOfFlight, NULL);
+}
+
+tof_sample_t tof_get_sample(){
+	tof_sample_t sample;
+
+	//the sample is written by the TOF thread, copy it atomically
+	chSysLock();
+	sample = last_sample;
+	chSysUnlock();
+	return sample;
+}
+
+event_source_t* tof_get_event(){
+	return &tof_event;
+}
@@ -0,0 +1,18 @@
+#ifndef TOF_H
+#define TOF_H
+
+//distance sample of the VL53L0X, after filtering
+typedef struct {
+	uint16_t dist_mm;
+	systime_t time;		//time of the measure
+	uint32_t seq;		//incremented on each new measure
+	bool valid;			//false if out of range, no target, or the filter isn't filled yet
+} tof_sample_t;
+
+//start the thread ranging with the VL53L0X, replaces VL53L0X_start()
+void tof_start(void);
+tof_sample_t tof_get_sample(void);
+//broadcast on each new sample
+event_source_t* tof_get_event(void);
+
+#endif /* TOF_H */